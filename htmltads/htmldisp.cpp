@@ -328,6 +328,27 @@ void CHtmlDisp::operator delete(void *ptr)
     }
 }
 
+/*
+ *   delete an item and give its memory back to the formatter 
+ */
+void CHtmlDisp::delete_for_reuse(CHtmlDisp *disp, size_t siz,
+                                 CHtmlFormatter *formatter)
+{
+    char *mem;
+    int from_fmt;
+
+    /* find our prefix, and check where the memory came from */
+    mem = ((char *)disp) - os_align_size(1);
+    from_fmt = (*mem == HTMLDISP_HEAPID_FMT);
+
+    /* delete the item */
+    delete disp;
+
+    /* if the formatter's heap owns the memory, let the formatter reuse it */
+    if (from_fmt && formatter != 0)
+        formatter->heap_free(mem, siz + os_align_size(1));
+}
+
 
 /*
  *   measure for table metrics 
@@ -949,6 +970,16 @@ void CHtmlDispText::draw(CHtmlSysWin *win,
     draw_text(win, sel_start, sel_end, 0, clicked, &pos_);
 }
 
+/*
+ *   Our line is done.  Tell the window about our text as draw() will show
+ *   it when we're not highlighted, so that it can prepare to draw it.  
+ */
+void CHtmlDispText::advise_line_done(CHtmlSysWin *win)
+{
+    if (displen_ != 0)
+        win->advise_text_item_layout(this, &pos_, font_, txt_, displen_);
+}
+
 /*
  *   draw the text, with appropriate style settings
  */
@@ -982,8 +1013,8 @@ void CHtmlDispText::draw_text(CHtmlSysWin *win,
         || (ofs >= sel_start && ofs + displen_ <= sel_end))
     {
         /* draw all of our text with the appropriate highlighting */
-        win->draw_text(ofs >= sel_start && ofs + displen_ <= sel_end,
-                       pos.left, pos.top, font, txt_, displen_);
+        win->draw_text_item(this, ofs >= sel_start && ofs + displen_ <= sel_end,
+                            pos.left, pos.top, font, txt_, displen_);
 
         /* we're done - there's nothing more to draw */
         return;
@@ -1182,6 +1213,45 @@ int CHtmlDispText::measure_width(CHtmlSysWin *)
     return pos_.right - pos_.left;
 }
 
+/*
+ *   merge the next item into this one
+ */
+int CHtmlDispText::merge_text(CHtmlDispText *nxt)
+{
+    /* the item must directly follow us and be in the same font */
+    if (nxt == 0 || nxt != get_next_disp() || nxt->font_ != font_)
+        return FALSE;
+
+    /*
+     *   we can't have any suppressed trailing text of our own, since that
+     *   would end up in the middle of the merged item
+     */
+    if (displen_ != len_)
+        return FALSE;
+
+    /* its text must pick up exactly where ours leaves off */
+    if (txt_ + len_ != nxt->txt_ || txtofs_ + len_ != nxt->txtofs_
+        || (unsigned long)len_ + nxt->len_ > 0xffff)
+        return FALSE;
+
+    /* it must abut us on the same line, with the same baseline */
+    if (pos_.right != nxt->pos_.left
+        || pos_.top != nxt->pos_.top || pos_.bottom != nxt->pos_.bottom
+        || ascent_ht_ != nxt->ascent_ht_)
+        return FALSE;
+
+    /* take over its text and its area */
+    displen_ = (unsigned short)(len_ + nxt->displen_);
+    len_ = (unsigned short)(len_ + nxt->len_);
+    pos_.right = nxt->pos_.right;
+
+    /* unlink it from the list */
+    unlink_next_disp();
+
+    /* success */
+    return TRUE;
+}
+
 /*
  *   invalidate a range 
  */
@@ -1242,6 +1312,22 @@ void CHtmlDispText::inval_range(CHtmlSysWin *win,
     win->inval_doc_coords(&rc);
 }
 
+/*
+ *   Measure a stretch of our text for table metrics.  We go through the
+ *   formatter's measurement memo when we have one, since tables are
+ *   measured over again every time they're laid out.  
+ */
+long CHtmlDispText::measure_for_table_text(CHtmlSysWin *win,
+                                           CHtmlTextMeasureEntry *memo,
+                                           const textchar_t *p, size_t len)
+{
+    if (memo != 0)
+        return win->get_formatter()->get_measure_memo()->measure(
+            win, memo, (size_t)(p - txt_), len);
+
+    return win->measure_text(font_, p, len, 0).x;
+}
+
 /*
  *   measure for table metrics 
  */
@@ -1254,10 +1340,17 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
     textchar_t prev_char;
     size_t rem;
     oshtml_charset_id_t charset;
+    CHtmlTextMeasureEntry *memo;
 
     /* note our character set */
     charset = font_->get_charset();
 
+    /* look up our text in the formatter's measurement memo */
+    memo = 0;
+    if (win->get_formatter() != 0 && len_ != 0)
+        memo = win->get_formatter()->get_measure_memo()->get_entry(
+            font_, txt_, len_);
+
     /* start at our first character */
     p = txt_;
     rem = len_;
@@ -1297,7 +1390,7 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
 
         /* add our width up to this point to the leftover */
         metrics->leftover_width_ +=
-            win->measure_text(font_, txt_, p - txt_, 0).x;
+            measure_for_table_text(win, memo, txt_, p - txt_);
 
         /* we don't need to use the leftover width */
         metrics->clear_leftover();
@@ -1343,9 +1436,9 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
                 if (last_break_pos != 0)
                 {
                     /* measure the width from the last break position */
-                    wid = win->
-                          measure_text(font_, last_break_pos,
-                                        (size_t)(p - last_break_pos), 0).x;
+                    wid = measure_for_table_text(
+                        win, memo, last_break_pos,
+                        (size_t)(p - last_break_pos));
                 }
                 else
                 {
@@ -1354,8 +1447,8 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
                      *   the current position, and add the leftover width
                      *   from the previous item 
                      */
-                    wid = win->measure_text(font_, txt_,
-                                            (size_t)(p - txt_), 0).x
+                    wid = measure_for_table_text(win, memo, txt_,
+                                                 (size_t)(p - txt_))
                           + metrics->leftover_width_;
 
                     /* we've now consumed the leftover width */
@@ -1370,7 +1463,7 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
             }
 
             /* add the separator to the line total */
-            wid = win->measure_text(font_, p, nxt - p, 0).x;
+            wid = measure_for_table_text(win, memo, p, nxt - p);
             metrics->add_to_cur_line(wid);
 
             /* remember the next character as the most recent break */
@@ -1390,8 +1483,8 @@ void CHtmlDispText::measure_for_table(CHtmlSysWin *win,
         metrics->leftover_width_ += measure_width(win);
     else if (last_break_pos < txt_ + len_)
         metrics->leftover_width_ +=
-            win->measure_text(font_, last_break_pos,
-                              (size_t)(len_ - (last_break_pos - txt_)), 0).x;
+            measure_for_table_text(win, memo, last_break_pos,
+                                   (size_t)(len_ - (last_break_pos - txt_)));
 
     /* remember my last character, if I have any characters */
     if (len_ != 0)
@@ -2463,7 +2556,8 @@ CHtmlDispTextGrid::~CHtmlDispTextGrid()
  *   Write text into the grid row
  */
 int CHtmlDispTextGrid::write_text(CHtmlSysWin *win, CHtmlSysFont *font,
-                                  int col, const textchar_t *txt, size_t len)
+                                  int col, const textchar_t *txt, size_t len,
+                                  int inval)
 {
     /* get my font descriptor */
     CHtmlFontDesc desc;
@@ -2492,6 +2586,54 @@ int CHtmlDispTextGrid::write_text(CHtmlSysWin *win, CHtmlSysFont *font,
           ++i, p = os_next_char(cs, p, bytes_ - (p - buf_.get()))) ;
     int endi = p - buf_.get();
 
+    /* figure the colors of the new cells */
+    textgrid_cellcolor_t newclr;
+    newclr.fg = desc.color;
+    newclr.bg = (desc.default_bgcolor ? 0x01000000 : desc.bgcolor);
+
+    /*
+     *   If we're to invalidate the changes, compare the new text against
+     *   the cells it overwrites, and note the byte range (relative to the
+     *   start of the new text) from the first to the last cell that
+     *   actually changes.  Cells past the current end of the row are all
+     *   new.  This has to happen before we touch the buffer.  
+     */
+    size_t chg_start = len, chg_end = 0;
+    if (inval)
+    {
+        const textchar_t *tp;
+        const char *op;
+        for (i = col, tp = txt, op = buf_.get() + starti ;
+             i < col + (int)charlen ; ++i)
+        {
+            const textchar_t *tnxt = os_next_char(cs, tp, len - (tp - txt));
+            int same = FALSE;
+
+            /* compare against the existing cell, if there is one */
+            if (i < chars_)
+            {
+                const char *onxt =
+                    os_next_char(cs, op, bytes_ - (op - buf_.get()));
+                same = (onxt - op == tnxt - tp
+                        && memcmp(op, tp, tnxt - tp) == 0
+                        && colors_[i].fg == newclr.fg
+                        && colors_[i].bg == newclr.bg);
+                op = onxt;
+            }
+
+            /* if it's different, extend the changed range */
+            if (!same)
+            {
+                if (chg_start == len)
+                    chg_start = tp - txt;
+                chg_end = tnxt - txt;
+            }
+
+            /* move on */
+            tp = tnxt;
+        }
+    }
+
     /* 
      *   figure the number of bytes after the replacement - this is the
      *   current length minus the removed length plus the added length 
@@ -2549,15 +2691,9 @@ int CHtmlDispTextGrid::write_text(CHtmlSysWin *win, CHtmlSysFont *font,
     /* figure the new byte length */
     bytes_ = trailingi + trailing_len;
 
-    /* set the colors */
+    /* set the colors; the background uses our special transparency flag */
     for (i = col, cp = colors_ + col ; i < col + (int)charlen ; ++i, ++cp)
-    {
-        /* set the foreground color */
-        cp->fg = desc.color;
-
-        /* set the background color; use our special flag for transparency */
-        cp->bg = (desc.default_bgcolor ? 0x01000000 : desc.bgcolor);
-    }
+        *cp = newclr;
 
     /* adjust the maximum column and size if we've expanded the width */
     if (col + (int)charlen >= chars_)
@@ -2575,13 +2711,149 @@ int CHtmlDispTextGrid::write_text(CHtmlSysWin *win, CHtmlSysFont *font,
         expanded = TRUE;
     }
 
-    /* invalidate our affected on-screen area */
-    inval_range(win, ofs_ + starti, ofs_ + starti + len);
+    /* invalidate the cells we changed */
+    if (chg_start < chg_end)
+        inval_range(win, ofs_ + starti + chg_start, ofs_ + starti + chg_end);
 
     /* return an indication of whether or not we expanded our width */
     return expanded;
 }
 
+/*
+ *   Copy the row, for comparison with inval_changes() 
+ */
+CHtmlDispTextGrid *CHtmlDispTextGrid::copy_row(CHtmlSysWin *win) const
+{
+    /* create a new row on the system heap */
+    CHtmlDispTextGrid *copy =
+        new ((class CHtmlFormatter *)0) CHtmlDispTextGrid(win, font_, ofs_);
+
+    /* copy our text */
+    if (buf_.get() != 0)
+        copy->buf_.set(buf_.get(), bytes_);
+    copy->bytes_ = bytes_;
+    copy->chars_ = chars_;
+
+    /* copy our cell colors */
+    if ((size_t)chars_ > copy->colors_max_)
+    {
+        copy->colors_max_ = chars_;
+        copy->colors_ = (textgrid_cellcolor_t *)th_realloc(
+            copy->colors_, copy->colors_max_ * sizeof(colors_[0]));
+    }
+    if (chars_ != 0)
+        memcpy(copy->colors_, colors_, chars_ * sizeof(colors_[0]));
+
+    /* copy our position */
+    copy->pos_ = pos_;
+    copy->ascent_ht_ = ascent_ht_;
+
+    /* return the copy */
+    return copy;
+}
+
+/*
+ *   Invalidate the cells that changed since a copy of the row was made 
+ */
+void CHtmlDispTextGrid::inval_changes(CHtmlSysWin *win,
+                                      const CHtmlDispTextGrid *old)
+{
+    /* 
+     *   if there's nothing to compare against, or the row has moved or has
+     *   a different font, cell positions don't correspond, so just redraw
+     *   everything 
+     */
+    if (old == 0 || old->font_ != font_
+        || old->pos_.left != pos_.left || old->pos_.top != pos_.top
+        || old->pos_.bottom != pos_.bottom)
+    {
+        if (old != 0)
+        {
+            CHtmlRect rc = old->pos_;
+            win->inval_doc_coords(&rc);
+        }
+        inval(win);
+        return;
+    }
+
+    /* get my character set */
+    CHtmlFontDesc desc;
+    font_->get_font_desc(&desc);
+    oshtml_charset_id_t cs = desc.charset;
+
+    /* 
+     *   Find the first and last cells that differ.  Note the byte offset of
+     *   the start of the first changed cell (which is the same in both rows,
+     *   since everything before it matches), and of the end of the last
+     *   changed cell in each row. 
+     */
+    const textchar_t *p0 = buf_.get(), *p = p0;
+    const textchar_t *op0 = old->buf_.get(), *op = op0;
+    int ncols = (chars_ > old->chars_ ? chars_ : old->chars_);
+    int first = -1;
+    size_t first_ofs = 0, last_ofs = 0, old_last_ofs = 0;
+    for (int i = 0 ; i < ncols ; ++i)
+    {
+        const textchar_t *nxt = p, *onxt = op;
+        int same;
+
+        /* find the next character in each row */
+        if (i < chars_)
+            nxt = os_next_char(cs, p, bytes_ - (p - p0));
+        if (i < old->chars_)
+            onxt = os_next_char(cs, op, old->bytes_ - (op - op0));
+
+        /* compare the cells */
+        same = (i < chars_ && i < old->chars_
+                && nxt - p == onxt - op
+                && memcmp(p, op, nxt - p) == 0
+                && colors_[i].fg == old->colors_[i].fg
+                && colors_[i].bg == old->colors_[i].bg);
+
+        /* if they differ, extend the changed range */
+        if (!same)
+        {
+            if (first < 0)
+            {
+                first = i;
+                first_ofs = p - p0;
+            }
+            last_ofs = nxt - p0;
+            old_last_ofs = onxt - op0;
+        }
+
+        /* move on */
+        p = nxt;
+        op = onxt;
+    }
+
+    /* if nothing changed, there's nothing to draw */
+    if (first < 0)
+        return;
+
+    /* 
+     *   figure the horizontal extent of the change - it ends at the end of
+     *   the last changed cell in either the old or new row, whichever is
+     *   further right 
+     */
+    CHtmlRect rc = pos_;
+    if (first_ofs != 0)
+        rc.left += win->measure_text(font_, p0, first_ofs, 0).x;
+    rc.right = pos_.left;
+    if (last_ofs != 0)
+        rc.right += win->measure_text(font_, p0, last_ofs, 0).x;
+    if (old_last_ofs != 0)
+    {
+        long old_right = pos_.left
+                         + win->measure_text(font_, op0, old_last_ofs, 0).x;
+        if (old_right > rc.right)
+            rc.right = old_right;
+    }
+
+    /* invalidate the changed cells */
+    win->inval_doc_coords(&rc);
+}
+
 /*
  *   Set our font 
  */
@@ -2679,7 +2951,7 @@ void CHtmlDispTextGrid::draw_part(CHtmlSysWin *win, int hilite,
             CHtmlSysFont *font = win->get_font(&desc);
 
             /* draw the text */
-            win->draw_text(hilite, x, pos_.top, font, pl, p - pl);
+            win->draw_text_item(this, hilite, x, pos_.top, font, pl, p - pl);
 
             /* if that was everything, stop looping */
             if (p >= pr)
@@ -236,6 +236,17 @@ public:
     static void *operator new(size_t siz, class CHtmlFormatter *formatter);
     static void operator delete(void *ptr);
 
+    /*
+     *   Delete an item, and give its memory back to the formatter that
+     *   allocated it, so that a new item of the same size can reuse it.
+     *   'siz' is the size of the item's class.  Ordinarily, items in the
+     *   formatter's heap are only freed along with the whole display list;
+     *   this is for items the formatter has removed from the list itself,
+     *   and that nothing refers to any more.  
+     */
+    static void delete_for_reuse(CHtmlDisp *disp, size_t siz,
+                                 class CHtmlFormatter *formatter);
+
     /*
      *   Get/set the line ID.  The formatter needs to be able to tell when
      *   two adjacent items in the display list are in different lines.
@@ -329,6 +340,14 @@ public:
                                  class CHtmlFormatter *,
                                  long /*line_spacing*/) { }
 
+    /*
+     *   Receive notification that the formatter has finished the line
+     *   containing this item, so the item is at its final position.  Items
+     *   can use this to let the window get ready to draw them.  This does
+     *   nothing by default.  
+     */
+    virtual void advise_line_done(class CHtmlSysWin *) { }
+
     /* get next object in display list */
     CHtmlDisp *get_next_disp() const { return nxt_; }
 
@@ -463,6 +482,13 @@ public:
     /* make me the end of my chain by forgetting my next item */
     void clear_next_disp() { nxt_ = 0; }
 
+    /* 
+     *   Remove my next item from the list, linking me directly to the item
+     *   after it.  This doesn't delete the removed item.  
+     */
+    void unlink_next_disp()
+        { if (nxt_ != 0) nxt_ = nxt_->nxt_; }
+
     /* invalidate my area on the display */
     void inval(class CHtmlSysWin *win);
 
@@ -486,6 +512,22 @@ public:
      */
     virtual void inval_link(class CHtmlSysWin *) { }
 
+    /*
+     *   Determine if I'm a link item - that is, whether inval_link() does
+     *   anything for me.  The formatter's link index includes all link
+     *   items, for hit-testing and link invalidation. 
+     */
+    virtual int is_link_item() const { return FALSE; }
+
+    /*
+     *   Get this item as a plain text item that the formatter can merge
+     *   with its neighbors once its line is finished, or null if the item
+     *   has any behavior beyond drawing its text.  Only the basic text
+     *   item qualifies; links, preformatted text, input text, and special
+     *   text all need to keep their own item boundaries. 
+     */
+    virtual class CHtmlDispText *get_mergeable_text() { return 0; }
+
     /* invalidate if appropriate for a change in the link 'clicked' status */
     virtual void on_click_change(class CHtmlSysWin *win)
         { inval(win); }
@@ -938,6 +980,7 @@ public:
 
     /* invalidate if I'm a link - I am, so invalidate me */
     void inval_link(class CHtmlSysWin *win) { inval(win); }
+    int is_link_item() const { return TRUE; }
 
     /* get my command-entering attributes */
     int get_append() const { return append_; }
@@ -1306,6 +1349,9 @@ public:
     void draw(class CHtmlSysWin *win, unsigned long sel_start,
               unsigned long sel_end, int clicked);
 
+    /* let the window prepare our text for drawing */
+    void advise_line_done(class CHtmlSysWin *win);
+
     /* do a line break */
     CHtmlDisp *find_line_break(class CHtmlFormatter *formatter,
                                class CHtmlSysWin *win,
@@ -1386,10 +1432,28 @@ public:
     /* get my text length */
     size_t get_text_len() const { return len_; }
 
+    /* plain text items can be merged with their neighbors */
+    virtual CHtmlDispText *get_mergeable_text() { return this; }
+
+    /*
+     *   Absorb the next item in the list into this item, if it simply
+     *   continues our text: it must be a mergeable text item in the same
+     *   font, immediately following us both in the text array and on the
+     *   same line of the display.  Returns true if we merged the item, in
+     *   which case we've unlinked it from the list.  The caller must make
+     *   sure nothing else still refers to the item.  
+     */
+    int merge_text(CHtmlDispText *nxt);
+
 protected:
     /* do some special construction-time initialization for linked text */
     void linked_text_cons(class CHtmlSysWin *win, class CHtmlDispLink *link);
 
+    /* measure part of our text for measure_for_table() */
+    long measure_for_table_text(class CHtmlSysWin *win,
+                                class CHtmlTextMeasureEntry *memo,
+                                const textchar_t *p, size_t len);
+
     /* 
      *   service routine for linkable subclasses: draw the text in the style
      *   appropriate for a linked item 
@@ -1617,6 +1681,8 @@ DEF_CHARWRAP_SUBCLASS(CHtmlDispText);
     \
     /* invalidate if I'm a link - I am, so invalidate me */ \
     void inval_link(class CHtmlSysWin *win) { inval(win); } \
+    int is_link_item() const { return TRUE; } \
+    CHtmlDispText *get_mergeable_text() { return 0; } \
     \
     /* get my link object */ \
     CHtmlDispLink *get_link(class CHtmlFormatter *, int, int) const \
@@ -1712,6 +1778,9 @@ public:
                      unsigned long txtofs)
         : CHtmlDispText(win, font, txt, len, txtofs) { }
 
+    /* preformatted text keeps its own item boundaries */
+    CHtmlDispText *get_mergeable_text() { return 0; }
+
     /* do a line break */
     CHtmlDisp *find_line_break(class CHtmlFormatter *formatter,
                                class CHtmlSysWin *win,
@@ -1761,6 +1830,9 @@ public:
 
     ~CHtmlDispTextInput();
 
+    /* input text is edited in place, so it can't be merged */
+    CHtmlDispText *get_mergeable_text() { return 0; }
+
     /* compare myself to another text display list */
     void diff_input_lists(CHtmlDispTextInput *other,
                           class CHtmlSysWin *win);
@@ -1889,10 +1961,26 @@ public:
      *   Writes text into the line, starting at the given column position.
      *   Returns true if we expand the row, which will affect text offsets in
      *   subsequent rows, false if we merely overwrite text that was already
-     *   in the row. 
+     *   in the row.  Only the cells whose contents actually change are
+     *   invalidated; if 'inval' is false, nothing is, and the caller takes
+     *   care of it. 
      */
     int write_text(class CHtmlSysWin *win, class CHtmlSysFont *font,
-                   int col, const textchar_t *txt, size_t len);
+                   int col, const textchar_t *txt, size_t len, int inval);
+
+    /*
+     *   Make a copy of the row on the system heap, for comparing against
+     *   later with inval_changes().  The caller must delete the copy. 
+     */
+    CHtmlDispTextGrid *copy_row(class CHtmlSysWin *win) const;
+
+    /*
+     *   Invalidate the cells that differ from those in an earlier copy of
+     *   the row (see copy_row()).  If 'old' is null, or the row has moved
+     *   or changed fonts since the copy was made, invalidate the whole row,
+     *   along with the area the old row covered. 
+     */
+    void inval_changes(class CHtmlSysWin *win, const CHtmlDispTextGrid *old);
 
     /* change our font, recalculating our size */
     void set_font(class CHtmlSysWin *win, class CHtmlSysFont *font);
@@ -2126,6 +2214,9 @@ public:
     {
     }
 
+    /* special text has a precomputed width, so it can't be merged */
+    CHtmlDispText *get_mergeable_text() { return 0; }
+
     /* 
      *   Get my width.  Assume that we've calculated our width in advance, so
      *   that we can simply use our position any time we're asked. 
@@ -2743,9 +2834,11 @@ public:
      */
     void inval_link(class CHtmlSysWin *win)
     {
-        if (usemap_.get_url() != 0 && usemap_.get_url()[0] != '\0')
+        if (is_link_item())
             inval(win);
     }
+    int is_link_item() const
+        { return usemap_.get_url() != 0 && usemap_.get_url()[0] != '\0'; }
 
     /* get my ALT text */
     virtual const textchar_t *get_alt_text() const
@@ -2851,6 +2944,7 @@ public:
 
     /* invalidate if I'm a link - I am, so invalidate me */
     void inval_link(class CHtmlSysWin *win) { inval(win); }
+    int is_link_item() const { return TRUE; }
 
     /* get my link object */
     CHtmlDispLink *get_link(class CHtmlFormatter *, int, int) const;
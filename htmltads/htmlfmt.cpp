@@ -366,6 +366,18 @@ CHtmlFormatter::CHtmlFormatter(CHtmlParser *parser)
     body_disp_ = 0;
     disp_head_ = disp_tail_ = 0;
 
+    /* no link index yet */
+    link_index_ = 0;
+    link_index_cnt_ = 0;
+    link_index_alloc_ = 0;
+    link_index_valid_ = FALSE;
+    link_index_last_ = 0;
+    link_index_line_ = 0;
+    link_index_div_ = 0;
+    link_index_div_idx_ = 0;
+    disp_list_gen_ = 0;
+    draw_cnt_ = 0;
+
     /* there's no deferred floater list yet */
     defer_head_ = defer_tail_ = 0;
 
@@ -388,6 +400,8 @@ CHtmlFormatter::CHtmlFormatter(CHtmlParser *parser)
     heap_pages_ = 0;
     heap_page_cur_ = 0;
     heap_page_cur_ofs_ = 0;
+    heap_free_list_ = 0;
+    heap_free_siz_ = 0;
 
     /* not in a link yet */
     cur_link_ = 0;
@@ -432,6 +446,10 @@ CHtmlFormatter::~CHtmlFormatter()
     /* delete line starts table */
     delete line_starts_;
 
+    /* delete the link index */
+    if (link_index_ != 0)
+        th_free(link_index_);
+
     /* delete the tab stop hash table */
     delete tab_table_;
 
@@ -516,12 +534,16 @@ void CHtmlFormatter::delete_display_list()
 
     /* clear out the division list */
     div_list_.clear();
+    line_div_tails_.clear();
     cur_div_ = 0;
 
     /* there's nothing in the lists now */
     disp_head_ = disp_tail_ = 0;
     defer_head_ = defer_tail_ = 0;
 
+    /* the old items are gone, so forget anything derived from them */
+    note_disp_list_edit();
+
     /* forget any current line start we were keeping */
     line_head_ = 0;
 
@@ -532,6 +554,7 @@ void CHtmlFormatter::delete_display_list()
      */
     heap_page_cur_ = 0;
     heap_page_cur_ofs_ = 0;
+    heap_free_list_ = 0;
 }
 
 /*
@@ -589,14 +612,17 @@ void CHtmlFormatter::set_phys_margins(const CHtmlRect *margins)
 /*
  *   Clear the display list 
  */
-void CHtmlFormatter::reset_disp_list()
+void CHtmlFormatter::reset_disp_list(int same_look)
 {
     /* if there's no window, there's nothing to do */
     if (win_ == 0)
         return;
 
     /* advise the window that we're about to delete the display list */
-    win_->advise_clearing_disp_list();
+    if (same_look)
+        win_->advise_replacing_disp_list();
+    else
+        win_->advise_clearing_disp_list();
 
     /* delete any old display list */
     delete_display_list();
@@ -846,12 +872,35 @@ int CHtmlFormatter::search_for_text(const textchar_t *txt, size_t txtlen,
 void CHtmlFormatter::extract_text(CStringBuf *buf,
                                   unsigned long start_ofs,
                                   unsigned long end_ofs) const
+{
+    /* extract everything in range, regardless of line boundaries */
+    extract_line_text(buf, start_ofs, end_ofs, -1, line_count_);
+}
+
+/*
+ *   Extract text from the text stream, limited to a range of lines 
+ */
+void CHtmlFormatter::extract_line_text(CStringBuf *buf,
+                                       unsigned long start_ofs,
+                                       unsigned long end_ofs,
+                                       long first_line, long end_line) const
 {
     CHtmlDisp *disp;
+    CHtmlDisp *stop;
+
+    /* find the item where we start */
+    if (first_line < 0)
+        disp = find_by_txtofs(start_ofs, FALSE, TRUE);
+    else if (first_line < line_count_)
+        disp = line_starts_->get(first_line);
+    else
+        disp = 0;
+
+    /* find the item where we stop; null means the end of the list */
+    stop = (end_line < line_count_ ? line_starts_->get(end_line) : 0);
 
     /* traverse our display items and pull out their text values */
-    for (disp = find_by_txtofs(start_ofs, FALSE, TRUE) ;
-         disp != 0 ; disp = disp->get_next_disp())
+    for ( ; disp != 0 && disp != stop ; disp = disp->get_next_disp())
     {
         /* if we're past the ending offset, we're done */
         if (disp->is_past_text_ofs(end_ofs))
@@ -862,6 +911,39 @@ void CHtmlFormatter::extract_text(CStringBuf *buf,
     }
 }
 
+/*
+ *   Find the line containing the given text offset 
+ */
+long CHtmlFormatter::find_line_by_txtofs(unsigned long txtofs) const
+{
+    long idx;
+
+    /* 
+     *   search the line starts table; it can hold stale entries past our
+     *   line count while lines are being formatted over again, so limit
+     *   the result to the lines that are currently valid 
+     */
+    idx = line_starts_->find_by_txtofs(txtofs);
+    if (idx >= line_count_)
+        idx = line_count_ - 1;
+    return (idx < 0 ? 0 : idx);
+}
+
+/*
+ *   Get the text offset at the start of a line 
+ */
+unsigned long CHtmlFormatter::get_line_start_ofs(long line_index) const
+{
+    CHtmlDisp *disp;
+
+    /* past the last line, use the end of the text */
+    if (line_index < 0 || line_index >= line_count_
+        || (disp = line_starts_->get(line_index)) == 0)
+        return get_text_ofs_max();
+
+    return disp->get_text_ofs();
+}
+
 /*
  *   Do some formatting and return.  We'll remember where we were, so the
  *   client can repeatedly call this routine to format an entire document.
@@ -1009,6 +1091,13 @@ void CHtmlFormatter::add_line_start(CHtmlDisp *item)
                 break;
         }
 
+        /* 
+         *   if we removed any lines that the link index has already
+         *   covered, the index is no longer valid 
+         */
+        if (link_index_valid_ && link_index_line_ >= line_count_)
+            inval_link_index();
+
         /* add the item */
         line_starts_->add(line_count_, item, curpos_.y);
         ++line_count_;
@@ -1026,7 +1115,7 @@ void CHtmlFormatter::add_line_start(CHtmlDisp *item)
 void CHtmlFormatter::add_to_disp_list(CHtmlDisp *item)
 {
     CHtmlDisp *nxt;
-    
+
     /*
      *   add it after the current end; or, if the list is empty, make it
      *   the head of the list 
@@ -1384,6 +1473,7 @@ void CHtmlFormatter::end_div()
     {
         /* note the last item covered in the DIV range */
         cur_div_->set_div_tail(disp_tail_);
+        line_div_tails_.add_ele(disp_tail_);
 
         /* pop the DIV stack */
         cur_div_ = cur_div_->get_parent_div();
@@ -1880,6 +1970,7 @@ void CHtmlFormatter::add_all_deferred_items(CHtmlDisp *prv_line_head,
         if (prv != 0)
         {
             /* found it - remove it from the list */
+            note_disp_list_trunc(prv);
             prv->clear_next_disp();
             disp_tail_ = prv;
         }
@@ -2026,6 +2117,9 @@ void CHtmlFormatter::remove_from_disp_list(long start_line,
     for ( ; cur != 0 && cur->get_next_disp() != item ;
           cur = cur->get_next_disp()) ;
 
+    /* we're inserting ahead of existing items */
+    note_disp_list_trunc(cur);
+
     /* if we found it, remove this item */
     if (cur != 0)
     {
@@ -2321,9 +2415,31 @@ void CHtmlFormatter::start_new_line(CHtmlDisp *next_line_head)
     /* set positions of items in the current line */
     set_line_positions(line_head_, next_line_head);
 
-    /* forget the old line head if we have a new one */
+    /* 
+     *   if the line is definitely finished, fold its runs of plain text
+     *   into single items 
+     */
     if (next_line_head != 0)
+        merge_line_items(line_head_, next_line_head);
+
+    /* 
+     *   if the line is finished, its items are where they'll be drawn, so
+     *   let them get ready for drawing - unless this is the first table
+     *   pass, which only measures 
+     */
+    if (next_line_head != 0 && table_pass_ != 1)
+    {
+        for (cur = line_head_ ; cur != 0 && cur != next_line_head ;
+             cur = cur->get_next_disp())
+            cur->advise_line_done(win_);
+    }
+
+    /* forget the old line head and its DIV tails if we have a new one */
+    if (next_line_head != 0)
+    {
         line_head_ = 0;
+        line_div_tails_.clear();
+    }
 
     /* if temporary margins are in effect, restore original margins */
     if (temp_margins_)
@@ -2579,6 +2695,99 @@ void CHtmlFormatter::set_line_positions(CHtmlDisp *line_head,
         win_->fmt_adjust_vscroll();
 }
 
+/*
+ *   Determine if we can merge the items on a finished line.  Table
+ *   formatting keeps going back over the same items on each pass, so don't
+ *   merge anything while a table is around. 
+ */
+int CHtmlFormatter::can_merge_line_items() const
+{
+    return (table_pass_ == 0 && current_table_ == 0);
+}
+
+/*
+ *   Determine if we're keeping a pointer to a display item outside of the
+ *   display list.  The display tail in particular can still be on the line
+ *   we're finishing: when add_disp_item() breaks a line in the middle of
+ *   the item it just added, it doesn't move the tail to the new piece until
+ *   the line break is done. 
+ */
+int CHtmlFormatter::is_disp_item_pinned(const CHtmlDisp *disp) const
+{
+    size_t i;
+
+    /* check our own pointers, and the line break state */
+    if (disp == disp_tail_
+        || disp == line_head_
+        || disp == pre_table_disp_tail_
+        || disp == pre_table_line_head_
+        || disp == link_index_last_
+        || breakpos_.refers_to(disp))
+        return TRUE;
+
+    /* check the DIVs that ended on this line */
+    for (i = 0 ; i < line_div_tails_.get_count() ; ++i)
+    {
+        if (disp == (CHtmlDisp *)line_div_tails_.get_ele(i))
+            return TRUE;
+    }
+
+    /* we don't refer to it */
+    return FALSE;
+}
+
+/*
+ *   Merge runs of plain text items on a finished line.  Once a line's
+ *   positions are set, a run of adjacent text items in one font draws
+ *   exactly like a single item covering the whole run, so we fold each
+ *   such run into its first item.  This keeps the display list from
+ *   growing by one item for every chunk of text the parser hands us, so
+ *   that drawing and hit-testing have fewer items to walk.  We never
+ *   remove the first item on the line, so the line starts table is
+ *   unaffected.
+ */
+void CHtmlFormatter::merge_line_items(CHtmlDisp *line_head,
+                                      CHtmlDisp *next_line_head)
+{
+    CHtmlDisp *cur;
+
+    /* if merging isn't allowed right now, leave the line alone */
+    if (line_head == 0 || !can_merge_line_items())
+        return;
+
+    /* scan the line */
+    for (cur = line_head ; cur != 0 && cur != next_line_head ; )
+    {
+        CHtmlDispText *txt;
+        CHtmlDisp *nxt;
+
+        /* if this isn't plain text, just move on */
+        nxt = cur->get_next_disp();
+        if ((txt = cur->get_mergeable_text()) == 0)
+        {
+            cur = nxt;
+            continue;
+        }
+
+        /* 
+         *   Absorb as many following items as we can.  Only plain text
+         *   items are mergeable, so each item we absorb is exactly a
+         *   CHtmlDispText; delete it and give its memory back to the heap,
+         *   so that new text items can reuse it.  
+         */
+        while (nxt != 0 && nxt != next_line_head
+               && !is_disp_item_pinned(nxt)
+               && txt->merge_text(nxt->get_mergeable_text()))
+        {
+            CHtmlDisp::delete_for_reuse(nxt, sizeof(CHtmlDispText), this);
+            nxt = txt->get_next_disp();
+        }
+
+        /* continue from the first item we couldn't merge */
+        cur = nxt;
+    }
+}
+
 /*
  *   Add an extra line height to the display height, beyond the height
  *   required for the layout height.  
@@ -2715,6 +2924,9 @@ void CHtmlFormatter::draw(const CHtmlRect *area, int clip_lines,
     long cur_ypos;
     long line_index;
 
+    /* count the redraw */
+    ++draw_cnt_;
+
     /* check line start records */
     if (line_starts_->get_count() == 0)
     {
@@ -2797,60 +3009,214 @@ void CHtmlFormatter::draw(const CHtmlRect *area, int clip_lines,
  */
 void CHtmlFormatter::inval_links_on_screen(const CHtmlRect *area)
 {
+    long first_line;
+    long i;
     CHtmlDisp *cur;
-    CHtmlRect curpos;
-    long line_index;
 
-    /* check line start records */
+    /* make sure the link index is up to date */
+    build_link_index();
+
+    /* find the first line containing the top of the area */
     if (line_starts_->get_count() == 0)
+        first_line = 0;
+    else
+        first_line = line_starts_->find_by_ypos(area->top);
+
+    /* 
+     *   invalidate links from the first line until we reach a line that
+     *   starts below the bottom of the area 
+     */
+    for (i = find_link_index_line(first_line) ; i < link_index_cnt_ ; ++i)
     {
-        /* no line starts - start at beginning of list */
-        line_index = 0;
-        cur = disp_head_;
+        CHtmlLinkIndexEntry *entry = &link_index_[i];
+
+        /* if this line isn't in view, we're done */
+        if (entry->line != first_line
+            && line_starts_->get_ypos(entry->line) > area->bottom)
+            break;
+
+        /* invalidate this link */
+        entry->disp->inval_link(win_);
     }
-    else
+
+    /* 
+     *   invalidate any links on the line we're still building, which the
+     *   index doesn't cover yet 
+     */
+    for (cur = (link_index_last_ != 0
+                ? link_index_last_->get_next_disp() : disp_head_) ;
+         cur != 0 ; cur = cur->get_next_disp())
+        cur->inval_link(win_);
+}
+
+/*
+ *   Determine if a display item reacts to the mouse, for the purposes of
+ *   the link index: it's either a link itself, or it has ALT text to show,
+ *   or it's within a DIV with a hover link.  'div' is the innermost DIV
+ *   containing the item.  
+ */
+static int is_link_index_item(const CHtmlDisp *disp, const CHtmlDispDIV *div)
+{
+    const textchar_t *alt;
+
+    /* links and items with ALT text always qualify */
+    if (disp->is_link_item())
+        return TRUE;
+    if ((alt = disp->get_alt_text()) != 0 && alt[0] != '\0')
+        return TRUE;
+
+    /* check for a DIV-level hyperlink in the enclosing DIVs */
+    for ( ; div != 0 ; div = div->get_parent_div())
     {
-        /* start at the first line containing the top of the area to draw */
-        line_index = line_starts_->find_by_ypos(area->top);
-        cur = line_starts_->get(line_index);
+        if (div->get_div_link() != 0)
+            return TRUE;
     }
 
-    /* invalidate links until we're out of view */
-    for (;;)
+    /* it doesn't react to the mouse */
+    return FALSE;
+}
+
+/*
+ *   Note that the display list is about to be cut off after the given
+ *   item. 
+ */
+void CHtmlFormatter::note_disp_list_trunc(CHtmlDisp *new_tail)
+{
+    CHtmlDisp *cur;
+
+    /* the existing items are changing */
+    note_disp_item_edit();
+
+    /* if the index doesn't cover any items yet, there's nothing to lose */
+    if (!link_index_valid_ || link_index_last_ == 0)
+        return;
+
+    /* if the whole list is going, so is the index */
+    if (new_tail == 0)
     {
-        CHtmlDisp *nxt_line;
-        long nxt_ypos;
+        inval_link_index();
+        return;
+    }
 
-        /* remember the next line and its position */
-        if (line_index + 1 < line_count_)
-        {
-            /* there's another line - get it */
-            nxt_line = line_starts_->get(line_index + 1);
-            nxt_ypos = line_starts_->get_ypos(line_index + 1);
-        }
-        else
+    /* 
+     *   if the last item we've indexed is among the items being removed,
+     *   the index refers to items that are going away, so discard it 
+     */
+    for (cur = new_tail->get_next_disp() ; cur != 0 ;
+         cur = cur->get_next_disp())
+    {
+        if (cur == link_index_last_)
         {
-            /* this is the last line */
-            nxt_line = 0;
-            nxt_ypos = layout_max_y_pos_;
+            inval_link_index();
+            return;
         }
+    }
+}
+
+/*
+ *   Bring the link index up to date.  We extend the index from the last
+ *   item we scanned up to the start of the line we're still building; if
+ *   the index has been discarded, we start over from the top of the list. 
+ */
+void CHtmlFormatter::build_link_index()
+{
+    CHtmlDisp *cur;
+    int is_link;
 
+    /* if the index has been discarded, start over with an empty index */
+    if (!link_index_valid_)
+    {
         /* 
-         *   invalidate links in the current line; stop when we reach the
-         *   start of the next line 
+         *   If there are no line starts, the whole list is one line.
+         *   Otherwise, items before the first line start can't be found by
+         *   position, so we treat them as being on no line at all. 
          */
-        for ( ; cur != 0 && cur != nxt_line ; cur = cur->get_next_disp())
-            cur->inval_link(win_);
+        link_index_cnt_ = 0;
+        link_index_last_ = 0;
+        link_index_line_ = (line_starts_->get_count() == 0 ? 0 : -1);
+        link_index_div_ = 0;
+        link_index_div_idx_ = 0;
+        link_index_valid_ = TRUE;
+    }
 
-        /* move on to the next line */
-        ++line_index;
+    /* 
+     *   Scan the items we haven't indexed yet, noting each line start and
+     *   DIV as we reach it.  Stop at the current line, since its items can
+     *   still be split up and re-wrapped as we add more to it. 
+     */
+    for (cur = (link_index_last_ != 0
+                ? link_index_last_->get_next_disp() : disp_head_) ;
+         cur != 0 && cur != line_head_ ; cur = cur->get_next_disp())
+    {
+        /* this is now the last item we've scanned */
+        link_index_last_ = cur;
 
-        /* if the next line isn't in view, don't display it */
-        if (cur == 0 || nxt_ypos > area->bottom)
-            break;
+        /* if this is the start of the next line, move on to that line */
+        while (link_index_line_ + 1 < line_starts_->get_count()
+               && cur == line_starts_->get(link_index_line_ + 1))
+            ++link_index_line_;
+
+        /* if this is the next DIV, it's now the innermost open DIV */
+        if (link_index_div_idx_ < div_list_.get_count()
+            && cur == (CHtmlDispDIV *)div_list_.get_ele(link_index_div_idx_))
+        {
+            link_index_div_ = (CHtmlDispDIV *)cur;
+            ++link_index_div_idx_;
+        }
+
+        /* check to see if it's a link item */
+        is_link = is_link_index_item(cur, link_index_div_);
+
+        /* close any DIVs that end with this item */
+        while (link_index_div_ != 0 && cur == link_index_div_->get_div_tail())
+            link_index_div_ = link_index_div_->get_parent_div();
+
+        /* if it's not a link item, or it's not on a line, skip it */
+        if (link_index_line_ < 0 || !is_link)
+            continue;
+
+        /* make room for the new entry if necessary */
+        if (link_index_cnt_ == link_index_alloc_)
+        {
+            size_t siz;
+
+            link_index_alloc_ += 256;
+            siz = link_index_alloc_ * sizeof(link_index_[0]);
+            if (link_index_ == 0)
+                link_index_ = (CHtmlLinkIndexEntry *)th_malloc(siz);
+            else
+                link_index_ = (CHtmlLinkIndexEntry *)th_realloc(
+                    link_index_, siz);
+        }
+
+        /* add it */
+        link_index_[link_index_cnt_].line = link_index_line_;
+        link_index_[link_index_cnt_].disp = cur;
+        ++link_index_cnt_;
     }
 }
 
+/*
+ *   Find the first link index entry at or after the given line.  The index
+ *   is in ascending line order, so we can do a binary search.  Returns the
+ *   entry count if there are no links at or after the line. 
+ */
+long CHtmlFormatter::find_link_index_line(long line_index) const
+{
+    long lo, hi;
+
+    for (lo = 0, hi = link_index_cnt_ ; lo < hi ; )
+    {
+        long cur = lo + (hi - lo)/2;
+
+        if (link_index_[cur].line < line_index)
+            lo = cur + 1;
+        else
+            hi = cur;
+    }
+    return lo;
+}
+
 
 /*
  *   Get the height of the line at the given y position 
@@ -3086,6 +3452,71 @@ CHtmlDisp *CHtmlFormatter::find_by_pos(CHtmlPoint pos, int exact) const
     }
 }
 
+/*
+ *   Find a linked item given a position 
+ */
+CHtmlDisp *CHtmlFormatter::find_link_by_pos(CHtmlPoint pos)
+{
+    long line_index;
+    long i;
+    CHtmlDisp *cur;
+
+    /* there's nothing above the top of the document */
+    if (pos.y < 0)
+        return 0;
+
+    /* make sure the link index is up to date */
+    build_link_index();
+
+    /* find the line containing the y position */
+    if (line_starts_->get_count() == 0)
+        line_index = 0;
+    else
+        line_index = line_starts_->find_by_ypos(pos.y);
+
+    /* check the links on this line for one containing the point */
+    for (i = find_link_index_line(line_index) ;
+         i < link_index_cnt_ && link_index_[i].line == line_index ; ++i)
+    {
+        CHtmlDisp *disp = link_index_[i].disp;
+
+        /* skip background items, as find_by_pos() does */
+        if (disp->get_pos().contains(pos) && !disp->is_in_background())
+            return disp;
+    }
+
+    /* 
+     *   The index doesn't cover the line we're still building, so check
+     *   its items directly.  We don't know the enclosing DIVs here without
+     *   tracking them through the line, so ask the item to look up its DIV
+     *   link, which is what its get_link() will do anyway. 
+     */
+    for (cur = (link_index_last_ != 0
+                ? link_index_last_->get_next_disp() : disp_head_) ;
+         cur != 0 ; cur = cur->get_next_disp())
+    {
+        if (cur->get_pos().contains(pos) && !cur->is_in_background()
+            && (is_link_index_item(cur, 0) || cur->find_div_link(this) != 0))
+            return cur;
+    }
+
+    /* 
+     *   There's no item here, but the point could still be in the blank
+     *   space of a DIV with a hover link.  The DIV's link is looked up
+     *   through its parents, so return the innermost DIV in that case, as
+     *   find_by_pos() does. 
+     */
+    CHtmlDispDIV *div = find_div_by_pos(pos);
+    for (CHtmlDispDIV *d = div ; d != 0 ; d = d->get_parent_div())
+    {
+        if (d->get_div_link() != 0)
+            return div;
+    }
+
+    /* there's nothing here that reacts to the mouse */
+    return 0;
+}
+
 /*
  *   Find the enclosing <DIV>, if any, given spatial coordinates within the
  *   document.  
@@ -3778,6 +4209,20 @@ void *CHtmlFormatter::heap_alloc(size_t siz)
 {
     void *ret;
 
+    /* 
+     *   If we have a block of the right size that was given back to us,
+     *   reuse it.  Don't do this while formatting a table, since a table
+     *   pass throws away everything allocated since the table started by
+     *   resetting the heap position, which wouldn't give the block back. 
+     */
+    if (heap_free_list_ != 0 && siz == heap_free_siz_
+        && table_pass_ == 0 && current_table_ == 0)
+    {
+        ret = heap_free_list_;
+        heap_free_list_ = *(void **)ret;
+        return ret;
+    }
+
     /* 
      *   if they're asking for more than the maximum page size, we must
      *   increase the unit size to satisfy the request 
@@ -3884,6 +4329,21 @@ void *CHtmlFormatter::heap_alloc(size_t siz)
 }
 
 
+/*
+ *   Give a block back for reuse 
+ */
+void CHtmlFormatter::heap_free(void *mem, size_t siz)
+{
+    /* we only keep blocks of one size; if this is another, just drop it */
+    if (heap_free_list_ != 0 && siz != heap_free_siz_)
+        return;
+
+    /* link the block into the free list */
+    heap_free_siz_ = siz;
+    *(void **)mem = heap_free_list_;
+    heap_free_list_ = mem;
+}
+
 /*
  *   Hash table entry for an image map 
  */
@@ -4310,6 +4770,7 @@ void CHtmlFormatter::end_table(CHtmlDispTable *table_disp,
             sub_head = table_disp->get_next_disp();
 
             /* detach the contents list from the table item itself */
+            note_disp_list_trunc(table_disp);
             table_disp->clear_next_disp();
 
             /* attach the contents list to the table as its sublist */
@@ -4458,6 +4919,7 @@ void CHtmlFormatter::run_table_pass_two(CHtmlTagTABLE *table_tag)
      *   formatter heap to the state they were in prior to starting the
      *   table.  
      */
+    note_disp_list_trunc(pre_table_disp_tail_);
     if (pre_table_disp_tail_ != 0)
         CHtmlDisp::delete_list(pre_table_disp_tail_->get_next_disp());
     heap_page_cur_ = pre_table_heap_page_cur_;
@@ -4655,6 +5117,7 @@ void CHtmlFormatter::pop_table_env()
      *   the caller will have saved the new stuff before calling us and will
      *   add it back in when appropriate 
      */
+    note_disp_list_trunc(p->disp_tail);
     disp_tail_ = p->disp_tail;
     if (disp_tail_ == 0)
         disp_head_ = 0;
@@ -5726,6 +6189,7 @@ void CHtmlFormatterInput::add_disp_item_input(CHtmlDispTextInput *item,
     if (input_pre_ != 0)
     {
         /* unlink it from the list */
+        note_disp_list_trunc(input_pre_);
         input_pre_->clear_next_disp();
         disp_tail_ = input_pre_;
 
@@ -6647,6 +7111,17 @@ CHtmlFormatterBannerExtGrid::CHtmlFormatterBannerExtGrid(
     /* we've never been sized to our contents */
     last_sized_ht_ = 0;
     last_sized_wid_ = 0;
+
+    /* we haven't been cleared */
+    cleared_rows_ = 0;
+    clear_pending_ = FALSE;
+    clear_draw_cnt_ = 0;
+}
+
+CHtmlFormatterBannerExtGrid::~CHtmlFormatterBannerExtGrid()
+{
+    /* delete any rows we were holding on to since the last clear */
+    discard_cleared_rows();
 }
 
 /* 
@@ -6658,6 +7133,16 @@ void CHtmlFormatterBannerExtGrid::start_at_top(int reset_sounds)
     int row;
     CHtmlSysFont *old_font;
 
+    /* 
+     *   if a clear is still pending, we're about to change the layout
+     *   anyway, so simply redraw everything 
+     */
+    if (clear_pending_)
+    {
+        discard_cleared_rows();
+        inval_window();
+    }
+
     /* remember the old font while we're resetting the state */
     old_font = get_font();
 
@@ -6735,7 +7220,7 @@ void CHtmlFormatterBannerExtGrid::start_at_top(int reset_sounds)
         /* if it's not wide enough, write some text to expand it */
         if (disp->get_text_columns() < last_sized_wid_)
             disp->write_text(get_win(), curfont_,
-                             last_sized_wid_ - 1, " ", 1);
+                             last_sized_wid_ - 1, " ", 1, TRUE);
 
         /* 
          *   Now, finally, we can be sure that we actually have a display
@@ -6869,6 +7354,14 @@ void CHtmlFormatterBannerExtGrid::write_text_at(
     if (get_win() == 0)
         return;
 
+    /* 
+     *   if we've been drawn since the last clear, bring the window up to
+     *   date now, so that we go back to invalidating changes as we make
+     *   them 
+     */
+    if (clear_pending_ && draw_cnt_ != clear_draw_cnt_)
+        inval_since_clear();
+
     /* presume we won't have to fix up any row offsets */
     fix_disp = 0;
 
@@ -6920,12 +7413,15 @@ void CHtmlFormatterBannerExtGrid::write_text_at(
             {
                 /* get the display item for the given row */
                 disp = get_disp_by_row(row);
+
+                /* we're rewriting the text of an existing row */
+                note_disp_item_edit();
             }
 
             /* if we have a display item, add the text to the item */
             if (disp != 0
                 && disp->write_text(get_win(), curfont_,
-                                    col, start, txt - start)
+                                    col, start, txt - start, !clear_pending_)
                 && fix_disp == 0)
             {
                 /*
@@ -7014,11 +7510,45 @@ void CHtmlFormatterBannerExtGrid::clear_contents()
 {
     CHtmlSysFont *old_font;
     
-    /* invalidate the entire window */
-    inval_window();
+    /* 
+     *   if a clear is already pending but we've been drawn since, the
+     *   copies we have aren't what's on the screen any more 
+     */
+    if (clear_pending_ && draw_cnt_ != clear_draw_cnt_)
+        inval_since_clear();
 
-    /* reset the display list */
-    reset_disp_list();
+    /* 
+     *   Rather than invalidating the entire window, keep copies of the rows
+     *   as they're displayed now; the next flush will redraw only what the
+     *   game hasn't written back the same way.  If a clear is still pending,
+     *   the copies we have are still what's on the screen.
+     *   
+     *   The window can keep whatever it has cached of the old display list's
+     *   appearance, since the screen won't change until we invalidate it.  
+     */
+    if (!clear_pending_ && get_win() != 0)
+    {
+        CHtmlDisp *cur;
+        CHtmlDisp *tail;
+
+        for (cur = disp_head_, tail = 0 ; cur != 0 ;
+             cur = cur->get_next_disp())
+        {
+            CHtmlDisp *copy =
+                ((CHtmlDispTextGrid *)cur)->copy_row(get_win());
+
+            if (tail != 0)
+                copy->add_list_after(tail);
+            else
+                cleared_rows_ = copy;
+            tail = copy;
+        }
+        clear_draw_cnt_ = draw_cnt_;
+    }
+    clear_pending_ = TRUE;
+
+    /* reset the display list, keeping its appearance until we invalidate */
+    reset_disp_list(TRUE);
 
     /* remember the old font before resetting the formatter state */
     old_font = get_font();
@@ -7052,6 +7582,77 @@ void CHtmlFormatterBannerExtGrid::clear_contents()
     max_ofs_ = 0;
 }
 
+/*
+ *   Invalidate the differences between what we displayed before the last
+ *   clear and what we display now 
+ */
+void CHtmlFormatterBannerExtGrid::inval_since_clear()
+{
+    CHtmlDisp *old;
+    CHtmlDisp *cur;
+
+    /* if there's no clear pending, there's nothing to do */
+    if (!clear_pending_)
+        return;
+
+    /* if we've lost our window, there's nothing to draw in */
+    if (get_win() == 0)
+    {
+        discard_cleared_rows();
+        return;
+    }
+
+    /* 
+     *   if we've been drawn since the clear, the window has already picked
+     *   up some of the rewritten rows, so we can't tell what it's showing
+     *   now; simply redraw everything 
+     */
+    if (draw_cnt_ != clear_draw_cnt_)
+    {
+        discard_cleared_rows();
+        inval_window();
+        return;
+    }
+
+    /* 
+     *   run through the old and new rows in parallel, invalidating the
+     *   changes in each row 
+     */
+    for (old = cleared_rows_, cur = disp_head_ ; old != 0 || cur != 0 ; )
+    {
+        if (cur == 0)
+        {
+            /* the old row is gone entirely */
+            old->inval(get_win());
+        }
+        else
+        {
+            /* redraw what changed in this row */
+            ((CHtmlDispTextGrid *)cur)->inval_changes(
+                get_win(), (CHtmlDispTextGrid *)old);
+        }
+
+        /* move on */
+        if (old != 0)
+            old = old->get_next_disp();
+        if (cur != 0)
+            cur = cur->get_next_disp();
+    }
+
+    /* we're done with the old rows */
+    discard_cleared_rows();
+}
+
+/*
+ *   Discard the copies of the rows we kept on clearing the grid 
+ */
+void CHtmlFormatterBannerExtGrid::discard_cleared_rows()
+{
+    CHtmlDisp::delete_list(cleared_rows_);
+    cleared_rows_ = 0;
+    clear_pending_ = FALSE;
+}
+
 /*
  *   get the character at the given text offset 
  */
@@ -7214,6 +7815,181 @@ void CHtmlFormatterBannerExtGrid::set_banner_screen_color(os_color_t color)
                                  color == OS_COLOR_P_TRANSPARENT);
 }
 
+/* ------------------------------------------------------------------------ */
+/*
+ *   Text measurement memo implementation 
+ */
+
+/* maximum number of strings we'll remember before starting over */
+const size_t HTML_MEASURE_MEMO_MAX = 4096;
+
+/*
+ *   Hash function for memo keys.  The keys start with the bytes of a font
+ *   pointer and go on to arbitrary text, so we need better mixing than the
+ *   simple character sums the other hash functions use.  This is FNV-1a. 
+ */
+class CHtmlHashFuncMeasureMemo: public CHtmlHashFunc
+{
+public:
+    unsigned int compute_hash(const textchar_t *str, size_t len)
+    {
+        unsigned int h;
+
+        for (h = 2166136261U ; len != 0 ; ++str, --len)
+        {
+            h ^= (unsigned char)*str;
+            h *= 16777619U;
+        }
+        return h;
+    }
+};
+
+/*
+ *   Memo entry.  The key is the font pointer followed by the text; we
+ *   keep our own copy of the key, and we measure our substrings from it.  
+ */
+class CHtmlTextMeasureEntry: public CHtmlHashEntryCS
+{
+public:
+    CHtmlTextMeasureEntry(const textchar_t *key, size_t keylen,
+                          CHtmlSysFont *font)
+        : CHtmlHashEntryCS(key, keylen, TRUE)
+    {
+        font_ = font;
+        meas_ = 0;
+        meas_cnt_ = 0;
+        meas_alloc_ = 0;
+    }
+
+    ~CHtmlTextMeasureEntry()
+    {
+        if (meas_ != 0)
+            th_free(meas_);
+    }
+
+    /* get a pointer to the text */
+    const textchar_t *get_text() const { return str_ + sizeof(font_); }
+
+    /* the font */
+    CHtmlSysFont *font_;
+
+    /* the substrings we've measured, in order of start and length */
+    struct meas_t
+    {
+        size_t start;
+        size_t len;
+        long wid;
+    } *meas_;
+    size_t meas_cnt_;
+    size_t meas_alloc_;
+};
+
+CHtmlTextMeasureMemo::CHtmlTextMeasureMemo()
+{
+    table_ = new CHtmlHashTable(1024, new CHtmlHashFuncMeasureMemo);
+    entry_cnt_ = 0;
+}
+
+CHtmlTextMeasureMemo::~CHtmlTextMeasureMemo()
+{
+    delete table_;
+}
+
+/*
+ *   Discard all entries 
+ */
+void CHtmlTextMeasureMemo::clear()
+{
+    table_->delete_all_entries();
+    entry_cnt_ = 0;
+}
+
+/*
+ *   Get the entry for a string in a font 
+ */
+CHtmlTextMeasureEntry *CHtmlTextMeasureMemo::get_entry(
+    CHtmlSysFont *font, const textchar_t *txt, size_t len)
+{
+    CHtmlTextMeasureEntry *entry;
+
+    /* build the key: the font pointer, followed by the text */
+    key_.ensure_size(sizeof(font) + len);
+    memcpy(key_.get(), &font, sizeof(font));
+    memcpy(key_.get() + sizeof(font), txt, len);
+
+    /* if we already have it, we're done */
+    entry = (CHtmlTextMeasureEntry *)table_->find(key_.get(),
+                                                  sizeof(font) + len);
+    if (entry != 0)
+        return entry;
+
+    /* 
+     *   if we've accumulated a lot of text, start over, so that we don't
+     *   hang on to text that's long gone from the window 
+     */
+    if (entry_cnt_ >= HTML_MEASURE_MEMO_MAX)
+        clear();
+
+    /* add a new entry */
+    entry = new CHtmlTextMeasureEntry(key_.get(), sizeof(font) + len, font);
+    table_->add(entry);
+    ++entry_cnt_;
+    return entry;
+}
+
+/*
+ *   Measure a substring of an entry's text 
+ */
+long CHtmlTextMeasureMemo::measure(CHtmlSysWin *win,
+                                   CHtmlTextMeasureEntry *entry,
+                                   size_t start, size_t len)
+{
+    size_t lo;
+    size_t hi;
+    long wid;
+
+    /* look for the substring among the ones we've measured already */
+    for (lo = 0, hi = entry->meas_cnt_ ; lo < hi ; )
+    {
+        size_t mid = (lo + hi) / 2;
+        CHtmlTextMeasureEntry::meas_t *m = &entry->meas_[mid];
+
+        if (m->start == start && m->len == len)
+            return m->wid;
+        else if (m->start < start || (m->start == start && m->len < len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* we haven't measured this one yet, so do it now */
+    wid = win->measure_text(entry->font_, entry->get_text() + start,
+                            len, 0).x;
+
+    /* make room to remember it */
+    if (entry->meas_cnt_ == entry->meas_alloc_)
+    {
+        size_t siz;
+
+        entry->meas_alloc_ += 16;
+        siz = entry->meas_alloc_ * sizeof(entry->meas_[0]);
+        entry->meas_ = (CHtmlTextMeasureEntry::meas_t *)
+                       (entry->meas_ == 0
+                        ? th_malloc(siz) : th_realloc(entry->meas_, siz));
+    }
+
+    /* insert it at its sorted position */
+    if (lo < entry->meas_cnt_)
+        memmove(&entry->meas_[lo + 1], &entry->meas_[lo],
+                (entry->meas_cnt_ - lo) * sizeof(entry->meas_[0]));
+    entry->meas_[lo].start = start;
+    entry->meas_[lo].len = len;
+    entry->meas_[lo].wid = wid;
+    ++entry->meas_cnt_;
+
+    return wid;
+}
+
 /* ------------------------------------------------------------------------ */
 /*
  *   Line-start table implementation 
@@ -122,6 +122,13 @@ public:
      */
     void note_non_ws() { ws_start_item_ = 0; }
 
+    /* determine if we're keeping a pointer to the given display item */
+    int refers_to(const class CHtmlDisp *item) const
+    {
+        return (item == item_ || item == ws_start_item_
+                || item == brk_ws_start_item_);
+    }
+
     /*
      *   Display object containing the line break.  Whenever a display
      *   object identifies a line break, it should store a pointer to
@@ -310,6 +317,58 @@ public:
     unsigned int no_break_sect_ : 1;
 };
 
+/* ------------------------------------------------------------------------ */
+/*
+ *   Text measurement memo.  Table layout measures the text in each cell
+ *   word by word to figure the cell's minimum and maximum widths, and
+ *   does so every time the window is reformatted.  The display items are
+ *   created afresh on each pass, so they can't remember their
+ *   measurements from one pass to the next; the formatter keeps this
+ *   memo for them instead.  For each string and font, the memo records
+ *   the widths of the substrings we've measured, so measuring the same
+ *   text in the same font again doesn't have to consult the font.
+ *   
+ *   Entries are keyed on the text itself rather than on where it's
+ *   stored, so they can't go stale when text is edited or moved; changed
+ *   text simply gets a new entry.  
+ */
+class CHtmlTextMeasureMemo
+{
+public:
+    CHtmlTextMeasureMemo();
+    ~CHtmlTextMeasureMemo();
+
+    /*
+     *   Get the entry for a string in a font, creating it if we don't
+     *   have one yet.  The entry remains valid until the next call to
+     *   get_entry() or clear(), since we might have to discard entries to
+     *   make room for a new one.  
+     */
+    class CHtmlTextMeasureEntry *get_entry(class CHtmlSysFont *font,
+                                           const textchar_t *txt,
+                                           size_t len);
+
+    /*
+     *   Measure a substring of an entry's text, given the byte offset and
+     *   length of the substring.  We return the saved width if we've
+     *   measured this substring before; otherwise we measure it through
+     *   the window and save the result.  
+     */
+    long measure(class CHtmlSysWin *win, class CHtmlTextMeasureEntry *entry,
+                 size_t start, size_t len);
+
+    /* discard all entries */
+    void clear();
+
+private:
+    /* the entries, keyed on the font and the text */
+    class CHtmlHashTable *table_;
+    size_t entry_cnt_;
+
+    /* scratch buffer for building keys */
+    CStringBuf key_;
+};
+
 /* ------------------------------------------------------------------------ */
 /*
  *   Line-start table.  We need to be able to find line starts quickly,
@@ -463,6 +522,20 @@ private:
     long count_;
 };
 
+/* ------------------------------------------------------------------------ */
+/*
+ *   Link index entry.  The formatter keeps an array of these, one per
+ *   display item that reacts to the mouse (a link, an item with ALT text,
+ *   or an item within a DIV with a hover link), in display list order.
+ *   Since the display list is in line order, the array is sorted by line
+ *   index, so we can find the links on a given line with a binary search.  
+ */
+struct CHtmlLinkIndexEntry
+{
+    long line;
+    class CHtmlDisp *disp;
+};
+
 /* ------------------------------------------------------------------------ */
 /*
  *   Flow-around item stack.  A flow-around item is an item in the left or
@@ -1006,6 +1079,44 @@ public:
     void extract_text(CStringBuf *buf,
                       unsigned long start_ofs, unsigned long end_ofs) const;
 
+    /*
+     *   Extract text from the text stream, limited to a range of lines.
+     *   This works like extract_text(), but starts at the first item of
+     *   line 'first_line', and stops at the first item of line 'end_line'.
+     *   A negative first_line starts at the item containing start_ofs, as
+     *   extract_text() does, and an end_line at or past the line count
+     *   runs to the end of the display list.
+     *   
+     *   Extracting adjacent line ranges yields exactly the same text as
+     *   extracting the combined range in one go, so a client can keep the
+     *   text of complete lines around and only extract the ends of a
+     *   large range afresh.  Anything kept this way is valid as long as
+     *   get_disp_list_gen() doesn't change and the lines still start at
+     *   the same text offsets.  
+     */
+    void extract_line_text(CStringBuf *buf,
+                           unsigned long start_ofs, unsigned long end_ofs,
+                           long first_line, long end_line) const;
+
+    /* get the text measurement memo for table layout */
+    CHtmlTextMeasureMemo *get_measure_memo() { return &measure_memo_; }
+
+    /* get the number of lines in the line starts table */
+    long get_line_count() const { return line_count_; }
+
+    /* find the line containing the given text offset */
+    long find_line_by_txtofs(unsigned long txtofs) const;
+
+    /* get the text offset at the start of the given line */
+    unsigned long get_line_start_ofs(long line_index) const;
+
+    /* 
+     *   Get the display list generation.  This changes whenever existing
+     *   display items are removed, rearranged or rewritten; adding new
+     *   items at the end of the list doesn't change it.  
+     */
+    unsigned long get_disp_list_gen() const { return disp_list_gen_; }
+
     /* get the height of the line at the given y position */
     long get_line_height_ypos(long ypos) const;
 
@@ -1044,6 +1155,17 @@ public:
      */
     class CHtmlDisp *find_by_pos(CHtmlPoint pos, int exact) const;
 
+    /*
+     *   Find an item that reacts to the mouse by position.  This considers
+     *   links (see CHtmlDisp::is_link_item()), items with ALT text, and
+     *   items within a DIV with a hover link.  It uses the link index
+     *   rather than scanning the display list, so it's cheap enough to call
+     *   on every mouse move.  Returns null if there's no such item at the
+     *   position, in which case there's nothing there for the mouse to
+     *   interact with.  
+     */
+    class CHtmlDisp *find_link_by_pos(CHtmlPoint pos);
+
     /*
      *   Find the <DIV> tag that covers the area containing the given
      *   position.  
@@ -1348,6 +1470,16 @@ public:
      */
     void *heap_alloc(size_t siz);
 
+    /*
+     *   Give a block back to the heap for reuse.  'siz' must be the size
+     *   originally passed to heap_alloc().  We only keep blocks of a single
+     *   size - the only blocks we get back are those of text items merged
+     *   away on finished lines - and hand them out again to heap_alloc()
+     *   requests of the same size.  Everything is released along with the
+     *   rest of the heap when the display list is deleted.  
+     */
+    void heap_free(void *mem, size_t siz);
+
     /* get my "stop" flag */
     int get_stop_formatting() const { return stop_formatting_; }
 
@@ -1451,9 +1583,12 @@ protected:
      *   Internal service routines to reset formatting.  start_at_top()
      *   normally calls both of these, but some subclasses might want just
      *   the display list clearing or just the internal state reset, so we
-     *   provide this separation of operations.  
+     *   provide this separation of operations.  If 'same_look' is true,
+     *   the display list is to be replaced with one that looks the same
+     *   except where we invalidate it, so the window can keep what it has
+     *   cached of its appearance.  
      */
-    void reset_disp_list();
+    void reset_disp_list(int same_look = FALSE);
     void reset_formatter_state(int reset_sounds);
 
     /*
@@ -1532,6 +1667,20 @@ protected:
     /* set positions for objects in a newly set line */
     void set_line_positions(CHtmlDisp *line_head, CHtmlDisp *next_line_head);
 
+    /* merge runs of plain text items on a finished line */
+    void merge_line_items(CHtmlDisp *line_head, CHtmlDisp *next_line_head);
+
+    /* determine if it's safe to merge items on finished lines right now */
+    virtual int can_merge_line_items() const;
+
+    /* 
+     *   Determine if we're keeping a pointer to the given display item
+     *   somewhere other than the display list itself.  An item we're
+     *   pointing to mustn't be merged into its predecessor, since the
+     *   pointer would then refer to an item that's no longer in the list. 
+     */
+    virtual int is_disp_item_pinned(const CHtmlDisp *disp) const;
+
     /* determine if a character is part of a word, punctuation, or space */
     int get_char_class(textchar_t c) const
     {
@@ -1762,6 +1911,77 @@ protected:
     /* DIV list */
     CHArrayList div_list_;
 
+    /* 
+     *   Last items of the DIVs that ended on the line we're building.  The
+     *   DIVs point to these, so they can't be merged away when the line is
+     *   finished. 
+     */
+    CHArrayList line_div_tails_;
+
+    /*
+     *   Link index.  This covers the display list up to the start of the
+     *   line we're still building, and is extended on demand as more lines
+     *   are finished; items on finished lines can't be split or moved to
+     *   another line, so the entries we've made stay good.  It's only
+     *   discarded when items we've already indexed are removed from the
+     *   list.  Item positions are always read from the items themselves, so
+     *   moving items around doesn't invalidate it.
+     *   
+     *   link_index_last_ is the last display item we've scanned, and
+     *   link_index_line_ is the line it's on.  link_index_div_ is the
+     *   innermost DIV that's open at that point, and link_index_div_idx_ is
+     *   the number of DIVs from the DIV list we've passed.  
+     */
+    CHtmlLinkIndexEntry *link_index_;
+    long link_index_cnt_;
+    long link_index_alloc_;
+    int link_index_valid_;
+    class CHtmlDisp *link_index_last_;
+    long link_index_line_;
+    class CHtmlDispDIV *link_index_div_;
+    size_t link_index_div_idx_;
+
+    /* discard the link index; it'll be rebuilt the next time it's needed */
+    void inval_link_index() { link_index_valid_ = FALSE; }
+
+    /*
+     *   Display list generation.  We bump this whenever existing display
+     *   items change: when items are removed from the list or inserted
+     *   anywhere but at the end, or when the text of an existing item is
+     *   rewritten.  Simply adding items at the end of the list leaves it
+     *   alone, since that doesn't affect anything about the lines we've
+     *   already laid out. 
+     */
+    unsigned long disp_list_gen_;
+
+    /* 
+     *   number of times we've drawn the display list, so that we can tell
+     *   whether the window has redrawn anything since some earlier point 
+     */
+    unsigned long draw_cnt_;
+
+    /* note a change to the contents of existing display items */
+    void note_disp_item_edit() { ++disp_list_gen_; }
+
+    /* note a change to the structure of the existing display list */
+    void note_disp_list_edit() { note_disp_item_edit(); inval_link_index(); }
+
+    /*
+     *   Note that we're about to cut off the display list after the given
+     *   item.  This only discards the link index if the index covers any
+     *   of the items being removed.  
+     */
+    void note_disp_list_trunc(class CHtmlDisp *new_tail);
+
+    /* bring the link index up to date with the finished lines */
+    void build_link_index();
+
+    /* text measurement memo for table layout */
+    CHtmlTextMeasureMemo measure_memo_;
+
+    /* find the first link index entry at or after the given line */
+    long find_link_index_line(long line_index) const;
+
     /* current DIV tag we're processing */
     class CHtmlDispDIV *cur_div_;
 
@@ -1821,6 +2041,13 @@ protected:
     /* offset of next free byte in current heap page */
     size_t heap_page_cur_ofs_;
 
+    /* 
+     *   blocks given back with heap_free(), linked through their first
+     *   bytes, and the size of each block in the list 
+     */
+    void *heap_free_list_;
+    size_t heap_free_siz_;
+
     /* 
      *   current hypertext link object - when we're within a link, this
      *   item must be set to contain the link information for objects
@@ -2213,6 +2440,23 @@ protected:
     /* clear the old input line */
     void clear_old_input();
 
+    /* 
+     *   don't merge line items while a command is being edited, since we
+     *   reformat the input line in place on every change 
+     */
+    virtual int can_merge_line_items() const
+    {
+        return (input_tag_ == 0
+                && CHtmlFormatterMain::can_merge_line_items());
+    }
+
+    /* we also keep pointers into the list around the input line */
+    virtual int is_disp_item_pinned(const CHtmlDisp *disp) const
+    {
+        return (disp == input_pre_ || disp == input_line_head_
+                || CHtmlFormatterMain::is_disp_item_pinned(disp));
+    }
+
     /*
      *   Item just before the active command input display list head --
      *   the active command input items are always the last items in the
@@ -2582,6 +2826,8 @@ class CHtmlFormatterBannerExtGrid: public CHtmlFormatterBannerExt
     friend class CHtmlFormatterBannerExt;
 
 public:
+    ~CHtmlFormatterBannerExtGrid();
+
     /* start formatting at the top of the tag list */
     virtual void start_at_top(int reset_sounds);
 
@@ -2595,8 +2841,12 @@ public:
         write_text_at(txt, len, csr_row_, csr_col_, TRUE);
     }
 
-    /* flush the source text - we don't buffer anything, so this is trivial */
-    virtual void flush_txtbuf(int) { }
+    /* 
+     *   flush the source text - we don't buffer anything, but this is where
+     *   we bring the display up to date after clearing and rewriting the
+     *   grid 
+     */
+    virtual void flush_txtbuf(int) { inval_since_clear(); }
 
     /* clear the contents */
     virtual void clear_contents();
@@ -2722,6 +2972,15 @@ protected:
     /* get the current default fixed-pitch font and remember it */
     void get_grid_font(int keep_color);
 
+    /* 
+     *   invalidate whatever differs from what was displayed before the last
+     *   clear_contents(), and forget the old contents 
+     */
+    void inval_since_clear();
+
+    /* discard the copy of the rows we kept on clearing the grid */
+    void discard_cleared_rows();
+
     /* current output position, in character cell coordinates */
     int csr_row_;
     int csr_col_;
@@ -2747,6 +3006,23 @@ protected:
      */
     int last_sized_ht_;
     int last_sized_wid_;
+
+    /*
+     *   Copies of the rows as they were displayed when the grid was last
+     *   cleared, linked through their display list pointers.  Games commonly
+     *   clear a status line and write it again from scratch every turn, so
+     *   rather than redrawing the whole window on a clear, we hold on to the
+     *   old rows until the next flush and then only redraw the cells that
+     *   are actually different.  Null if there's no clear pending.
+     *   
+     *   This only works as long as the window is still showing the old
+     *   rows.  clear_draw_cnt_ is our draw count as of the clear; if we're
+     *   drawn while the clear is pending, the window has picked up the
+     *   partly rewritten rows, so we just redraw everything instead.  
+     */
+    class CHtmlDisp *cleared_rows_;
+    int clear_pending_;
+    unsigned long clear_draw_cnt_;
 };
 
 
@@ -372,3 +372,280 @@ void CHtmlHashTable::enum_entries(void (*func)(void *, CHtmlHashEntry *),
     }
 }
 
+
+/* ------------------------------------------------------------------------ */
+/*
+ *   Keyword table 
+ */
+
+CHtmlKeywordTable::CHtmlKeywordTable()
+{
+    /* no entries yet */
+    entries_ = 0;
+    entry_cnt_ = 0;
+    entry_alloc_ = 0;
+
+    /* we don't have a lookup table until we're built */
+    table_ = 0;
+    table_size_ = 0;
+    disp_ = 0;
+    bucket_cnt_ = 0;
+    max_len_ = 0;
+}
+
+CHtmlKeywordTable::~CHtmlKeywordTable()
+{
+    size_t i;
+
+    /* delete the entries */
+    for (i = 0 ; i < entry_cnt_ ; ++i)
+        delete entries_[i];
+
+    /* delete the arrays */
+    delete [] entries_;
+    delete [] table_;
+    delete [] disp_;
+}
+
+/*
+ *   Add a keyword 
+ */
+void CHtmlKeywordTable::add(CHtmlHashEntry *entry)
+{
+    size_t i;
+
+    /* if we already have this keyword, replace the old entry */
+    for (i = 0 ; i < entry_cnt_ ; ++i)
+    {
+        if (matches(entries_[i], entry->getstr(), entry->getlen()))
+        {
+            delete entries_[i];
+            entries_[i] = entry;
+            return;
+        }
+    }
+
+    /* make room for the new entry if necessary */
+    if (entry_cnt_ == entry_alloc_)
+    {
+        CHtmlHashEntry **new_entries;
+
+        entry_alloc_ += 64;
+        new_entries = new CHtmlHashEntry *[entry_alloc_];
+        if (entry_cnt_ != 0)
+            memcpy(new_entries, entries_, entry_cnt_ * sizeof(*entries_));
+        delete [] entries_;
+        entries_ = new_entries;
+    }
+
+    /* add it */
+    entries_[entry_cnt_++] = entry;
+    if (entry->getlen() > max_len_)
+        max_len_ = entry->getlen();
+}
+
+/*
+ *   Build the lookup table 
+ */
+void CHtmlKeywordTable::build()
+{
+    size_t table_size;
+    size_t bucket_cnt;
+
+    /* 
+     *   Start with a table that's at most half full, and about two
+     *   keywords per bucket; if we can't find displacements that place
+     *   every keyword, keep doubling the table size until we can.  
+     */
+    for (table_size = 16 ; table_size < entry_cnt_ * 2 ; table_size <<= 1) ;
+    for (bucket_cnt = 4 ; bucket_cnt < entry_cnt_ / 2 ; bucket_cnt <<= 1) ;
+    while (!try_build(table_size, bucket_cnt))
+        table_size <<= 1;
+}
+
+/*
+ *   Try laying out the table 
+ */
+int CHtmlKeywordTable::try_build(size_t table_size, size_t bucket_cnt)
+{
+    size_t *order;
+    unsigned int *hashes;
+    size_t i;
+    size_t b;
+    int ok;
+
+    /* set up the new, empty table */
+    delete [] table_;
+    delete [] disp_;
+    table_size_ = table_size;
+    bucket_cnt_ = bucket_cnt;
+    table_ = new CHtmlHashEntry *[table_size_];
+    disp_ = new unsigned int[bucket_cnt_];
+    for (i = 0 ; i < table_size_ ; ++i)
+        table_[i] = 0;
+    for (b = 0 ; b < bucket_cnt_ ; ++b)
+        disp_[b] = 0;
+
+    /* hash each keyword */
+    hashes = new unsigned int[entry_cnt_ + 1];
+    for (i = 0 ; i < entry_cnt_ ; ++i)
+        hashes[i] = compute_hash(entries_[i]->getstr(),
+                                 entries_[i]->getlen());
+
+    /* 
+     *   Sort the buckets so that we place the fullest ones first, while
+     *   the table is still mostly empty; those are the hardest to fit.
+     *   There are only a few dozen buckets, so a simple insertion sort on
+     *   the bucket sizes will do.  
+     */
+    order = new size_t[bucket_cnt_ * 2];
+    {
+        size_t *cnt = order + bucket_cnt_;
+
+        for (b = 0 ; b < bucket_cnt_ ; ++b)
+            cnt[b] = 0;
+        for (i = 0 ; i < entry_cnt_ ; ++i)
+            ++cnt[hashes[i] & (bucket_cnt_ - 1)];
+        for (b = 0 ; b < bucket_cnt_ ; ++b)
+        {
+            size_t j;
+
+            for (j = b ; j > 0 && cnt[order[j - 1]] < cnt[b] ; --j)
+                order[j] = order[j - 1];
+            order[j] = b;
+        }
+    }
+
+    /* find a displacement for each bucket in turn */
+    for (ok = TRUE, b = 0 ; ok && b < bucket_cnt_ ; ++b)
+    {
+        size_t bucket = order[b];
+        unsigned int disp;
+
+        /* try displacements until everything in the bucket fits */
+        for (disp = 0 ; disp < 65536 ; ++disp)
+        {
+            /* check for collisions with each other or earlier buckets */
+            for (i = 0 ; i < entry_cnt_ ; ++i)
+            {
+                unsigned int slot;
+
+                if ((hashes[i] & (bucket_cnt_ - 1)) != bucket)
+                    continue;
+
+                /* 
+                 *   stop if the slot is taken; if it's taken by another
+                 *   member of this bucket, clear out our partial
+                 *   placement before trying the next displacement 
+                 */
+                slot = get_slot(hashes[i], disp);
+                if (table_[slot] != 0)
+                    break;
+                table_[slot] = entries_[i];
+            }
+
+            /* if we placed everything, this displacement works */
+            if (i == entry_cnt_)
+                break;
+
+            /* undo the partial placement */
+            while (i-- > 0)
+            {
+                if ((hashes[i] & (bucket_cnt_ - 1)) == bucket)
+                    table_[get_slot(hashes[i], disp)] = 0;
+            }
+        }
+
+        /* if nothing worked, the table is too crowded */
+        if (disp == 65536)
+            ok = FALSE;
+        else
+            disp_[bucket] = disp;
+    }
+
+    /* done with our scratch arrays */
+    delete [] order;
+    delete [] hashes;
+
+    return ok;
+}
+
+/*
+ *   Compute the hash value of a string, ignoring case.  This is FNV-1a
+ *   over the case-folded characters.  Folding with a simple OR is only
+ *   correct for letters, but all that matters here is that both cases of
+ *   a letter hash the same; matches() takes care of the rest.  
+ */
+unsigned int CHtmlKeywordTable::compute_hash(const textchar_t *str,
+                                             size_t len)
+{
+    unsigned int h;
+
+    for (h = 2166136261U ; len != 0 ; ++str, --len)
+    {
+        h ^= (unsigned char)(*str | 0x20);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ *   Compute the slot for a hash value and bucket displacement.  We mix the
+ *   displacement into the hash and run the result through a finalizer, so
+ *   that each displacement scatters the bucket's keywords differently. 
+ */
+unsigned int CHtmlKeywordTable::get_slot(unsigned int hash,
+                                         unsigned int disp) const
+{
+    hash ^= disp * 0x9E3779B9U;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6BU;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35U;
+    hash ^= hash >> 16;
+    return hash & (table_size_ - 1);
+}
+
+/*
+ *   Determine if an entry matches a string, ignoring case 
+ */
+int CHtmlKeywordTable::matches(const CHtmlHashEntry *entry,
+                               const textchar_t *str, size_t len)
+{
+    const textchar_t *p;
+
+    if (entry->getlen() != len)
+        return FALSE;
+
+    for (p = entry->getstr() ; len != 0 ; ++p, ++str, --len)
+    {
+        /* 
+         *   identical characters match; otherwise they only match if
+         *   they're the two cases of the same letter 
+         */
+        if (*p != *str
+            && ((*p | 0x20) != (*str | 0x20)
+                || (*p | 0x20) < 'a' || (*p | 0x20) > 'z'))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ *   Find a keyword 
+ */
+CHtmlHashEntry *CHtmlKeywordTable::find(const textchar_t *str,
+                                        size_t len) const
+{
+    unsigned int hash;
+    CHtmlHashEntry *entry;
+
+    /* nothing longer than our longest keyword can match */
+    if (len > max_len_ || table_ == 0)
+        return 0;
+
+    /* there's only one place the keyword can be */
+    hash = compute_hash(str, len);
+    entry = table_[get_slot(hash, disp_[hash & (bucket_cnt_ - 1)])];
+    return (entry != 0 && matches(entry, str, len) ? entry : 0);
+}
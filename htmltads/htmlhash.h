@@ -150,6 +150,70 @@ private:
     CHtmlHashFunc *hash_function_;
 };
 
+/* ------------------------------------------------------------------------ */
+/*
+ *   Keyword table.  This is a case-insensitive lookup table for a fixed
+ *   set of keywords, such as the tag and attribute names the parser
+ *   recognizes.  All of the keywords are added up front; build() then
+ *   computes a perfect hash for the set, using the "hash and displace"
+ *   scheme: each keyword's hash value selects a bucket, and each bucket
+ *   has a displacement value chosen so that no two keywords end up in the
+ *   same slot.  A lookup thus takes a single pass over the string to hash
+ *   it, and at most one string comparison.
+ *   
+ *   Keywords must be added before the table is built, and can't be
+ *   removed.  If the same keyword is added twice (ignoring case), the
+ *   later entry replaces the earlier one.  
+ */
+class CHtmlKeywordTable
+{
+public:
+    CHtmlKeywordTable();
+    ~CHtmlKeywordTable();
+
+    /* 
+     *   Add a keyword.  As with CHtmlHashTable, the table takes ownership
+     *   of the entry, and deletes it when the table is deleted. 
+     */
+    void add(CHtmlHashEntry *entry);
+
+    /* build the lookup table, once all of the keywords have been added */
+    void build();
+
+    /* find the entry for a keyword, ignoring case */
+    CHtmlHashEntry *find(const textchar_t *str, size_t len) const;
+
+private:
+    /* compute the hash value of a string, ignoring case */
+    static unsigned int compute_hash(const textchar_t *str, size_t len);
+
+    /* compute the slot for a hash value, given a bucket displacement */
+    unsigned int get_slot(unsigned int hash, unsigned int disp) const;
+
+    /* determine if an entry matches a string, ignoring case */
+    static int matches(const CHtmlHashEntry *entry,
+                       const textchar_t *str, size_t len);
+
+    /* try to lay out the table with the given size; returns true on success */
+    int try_build(size_t table_size, size_t bucket_cnt);
+
+    /* the keywords, in the order added */
+    CHtmlHashEntry **entries_;
+    size_t entry_cnt_;
+    size_t entry_alloc_;
+
+    /* the slots, each with the keyword that hashes there, or null */
+    CHtmlHashEntry **table_;
+    size_t table_size_;
+
+    /* displacement values for the buckets */
+    unsigned int *disp_;
+    size_t bucket_cnt_;
+
+    /* length of the longest keyword */
+    size_t max_len_;
+};
+
 /* ------------------------------------------------------------------------ */
 /*
  *   Simple case-insensitive hash function 
@@ -54,6 +54,80 @@ Modified
 #include <stdarg.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/* ------------------------------------------------------------------------ */
+/*
+ *   Plain text scanner.  Plain text is printable ASCII other than the
+ *   markup characters '<' and '&': each such byte is a character on its
+ *   own in every character set we handle, and the parser copies it to the
+ *   text stream as-is.  Everything else - whitespace, control characters,
+ *   markups, entities, and the lead bytes of multi-byte characters - needs
+ *   a closer look.
+ */
+static inline int is_plain_text_char(textchar_t c)
+{
+    return ((unsigned char)c > ' ' && (unsigned char)c < 0x7F
+            && c != '<' && c != '&');
+}
+
+/*
+ *   Find the length of the run of plain text at the start of a buffer,
+ *   looking at no more than 'maxlen' bytes.  
+ */
+static size_t scan_plain_text(const textchar_t *p, size_t len, size_t maxlen)
+{
+    size_t i;
+
+    /* don't look further than the caller wants */
+    if (len > maxlen)
+        len = maxlen;
+
+    i = 0;
+
+#ifdef __SSE2__
+    /*
+     *   Check 16 bytes at a time.  As signed bytes, everything above ' ' up
+     *   to and including DEL compares greater than ' ', and the bytes with
+     *   the high bit set are negative, so one signed comparison leaves us
+     *   with just DEL, '<' and '&' to rule out.  
+     */
+    {
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i del = _mm_set1_epi8(0x7F);
+        const __m128i lt = _mm_set1_epi8('<');
+        const __m128i amp = _mm_set1_epi8('&');
+
+        for ( ; i + 16 <= len ; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, del), _mm_cmpeq_epi8(v, lt)),
+                _mm_cmpeq_epi8(v, amp));
+            __m128i plain = _mm_andnot_si128(special,
+                                             _mm_cmpgt_epi8(v, space));
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(plain);
+
+            /* if any byte in this block isn't plain, find the first one */
+            if (mask != 0xFFFF)
+            {
+                for ( ; (mask & 1) != 0 ; mask >>= 1)
+                    ++i;
+                return i;
+            }
+        }
+    }
+#endif
+
+    /* check the remaining bytes one at a time */
+    for ( ; i < len && is_plain_text_char(p[i]) ; ++i) ;
+
+    return i;
+}
+
 
 /* ------------------------------------------------------------------------ */
 /*
@@ -688,8 +762,8 @@ void CHtmlParser::init(int literal_mode)
         amp_table_->add(entry);
     }
 
-    /* create a hash table for the tags, and fill it up */
-    tag_table_ = new CHtmlHashTable(256, new CHtmlHashFuncCI);
+    /* create a keyword table for the tags, and fill it up */
+    tag_table_ = new CHtmlKeywordTable;
     for (tagptr = tag_tbl ; tagptr->name_func != 0 ; ++tagptr)
     {
         CHtmlHashEntryTag *entry;
@@ -707,9 +781,10 @@ void CHtmlParser::init(int literal_mode)
                                       tagptr->end_func);
         tag_table_->add(entry);
     }
+    tag_table_->build();
 
-    /* create and populate the hash table for attribute names */
-    attr_table_ = new CHtmlHashTable(256, new CHtmlHashFuncCI);
+    /* create and populate the keyword table for attribute names */
+    attr_table_ = new CHtmlKeywordTable;
     for (attr = attr_list ; attr->nm != 0 ; ++attr)
     {
         CHtmlHashEntryAttr *entry;
@@ -718,9 +793,10 @@ void CHtmlParser::init(int literal_mode)
                                        FALSE, attr->id);
         attr_table_->add(entry);
     }
+    attr_table_->build();
 
-    /* create and populate the hash table for attribute value names */
-    attr_val_table_ = new CHtmlHashTable(256, new CHtmlHashFuncCI);
+    /* create and populate the keyword table for attribute value names */
+    attr_val_table_ = new CHtmlKeywordTable;
     for (attr = val_list ; attr->nm != 0 ; ++attr)
     {
         CHtmlHashEntryAttr *entry;
@@ -729,6 +805,7 @@ void CHtmlParser::init(int literal_mode)
                                        FALSE, attr->id);
         attr_val_table_->add(entry);
     }
+    attr_val_table_->build();
 
     /* allocate the text array for storing the text stream */
     text_array_ = new CHtmlTextArray;
@@ -758,7 +835,7 @@ void CHtmlParser::init(int literal_mode)
  */
 CHtmlParser::~CHtmlParser()
 {
-    /* delete the hash tables */
+    /* delete the hash and keyword tables */
     delete amp_table_;
     delete tag_table_;
     delete attr_table_;
@@ -2241,6 +2318,24 @@ void CHtmlParser::parse_text()
     if (curtext_.getlen() > 30000)
         add_text_tag();
 
+    /*
+     *   If we're looking at a run of plain text, copy the whole run to the
+     *   text stream in one go.  parse_char() would pass each of these
+     *   characters through unchanged, so this is only a shortcut; stop
+     *   where the buffer limit above would have flushed the text.  
+     */
+    len = scan_plain_text(p_.gettext(), p_.getlen(),
+                          30001 - curtext_.getlen());
+    if (len != 0)
+    {
+        curtext_.append(p_.gettext(), len);
+        p_.inc(len);
+
+        /* the run ends in a non-space, so keep the next whitespace */
+        eat_whitespace_ = FALSE;
+        return;
+    }
+
     /* get the current character */
     len = parse_char(buf, sizeof(buf), &charset, &changed_charset, &special);
 
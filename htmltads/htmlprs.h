@@ -363,13 +363,13 @@ private:
     class CHtmlHashTable *amp_table_;
 
     /* Hash table for the tag names */
-    class CHtmlHashTable *tag_table_;
+    class CHtmlKeywordTable *tag_table_;
 
     /* hash table for attribute names */
-    class CHtmlHashTable *attr_table_;
+    class CHtmlKeywordTable *attr_table_;
 
     /* hash table for attribute value names */
-    class CHtmlHashTable *attr_val_table_;
+    class CHtmlKeywordTable *attr_val_table_;
 
     /* current container */
     class CHtmlTagContainer *container_;
@@ -1181,6 +1181,35 @@ public:
                            class CHtmlSysFont *font,
                            const textchar_t *str, size_t len) = 0;
 
+    /*
+     *   Draw the text of a display item.  This works exactly like
+     *   draw_text(), but also identifies the display item that's drawing,
+     *   so that a system window that keeps information per item (such as
+     *   pre-shaped text) can find it.  The item is only meant to be used as
+     *   a key; an item can draw several pieces of text, and an item's
+     *   memory can be reused for a new item once it's deleted.  The default
+     *   implementation simply calls draw_text().  
+     */
+    virtual void draw_text_item(const class CHtmlDisp *,
+                                int hilite, long x, long y,
+                                class CHtmlSysFont *font,
+                                const textchar_t *str, size_t len)
+        { draw_text(hilite, x, y, font, str, len); }
+
+    /*
+     *   Receive notification that the formatter has laid out a display
+     *   item's text at its final position.  'pos' is the item's area, and
+     *   the font and text are what the item will pass to draw_text_item()
+     *   when drawn normally.  A system window can use this to prepare for
+     *   drawing the text, so that less work is left for painting.  This
+     *   does nothing by default.  
+     */
+    virtual void advise_text_item_layout(const class CHtmlDisp *,
+                                         const CHtmlRect * /*pos*/,
+                                         class CHtmlSysFont * /*font*/,
+                                         const textchar_t * /*str*/,
+                                         size_t /*len*/) { }
+
     /*
      *   Draw typographical text space.  This is related to draw_text(), but
      *   rather than drawing text, this simply draws a space of the given
@@ -1560,6 +1589,19 @@ public:
      */
     virtual void advise_clearing_disp_list() = 0;
 
+    /*
+     *   Receive notification that the formatter is about to replace its
+     *   display list with one that will look the same, except for the areas
+     *   the formatter explicitly invalidates.  Text grid banners do this
+     *   when they're cleared and rewritten.  As with
+     *   advise_clearing_disp_list(), the window must forget any display
+     *   list items it's referencing, but anything it keeps of the window's
+     *   appearance is still good.  By default, this simply calls
+     *   advise_clearing_disp_list().  
+     */
+    virtual void advise_replacing_disp_list()
+        { advise_clearing_disp_list(); }
+
     /*
      *   Scroll a document position into view.  This should try to scroll
      *   the window so that the given coordinates appear at the middle of
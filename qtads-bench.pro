@@ -0,0 +1,27 @@
+# Headless benchmark build of QTads.
+#
+# Runs a game on the offscreen platform plugin, replays a command script into
+# it and reports the time spent parsing, formatting and painting on every
+# turn, along with peak memory use. No display is needed:
+#
+#   qmake qtads-bench.pro && make
+#   ./qtads-bench [--size WxH] [--frames dir] game.t3 commands.txt
+#
+# Audio is disabled, since it has nothing to do with what we measure.
+CONFIG += disable-audio
+include(qtads.pro)
+
+TARGET = qtads-bench
+CONFIG -= app_bundle
+DEFINES += QTADS_BENCHMARK
+
+# Keep the object files apart from those of the normal build, since some of
+# them are compiled differently.
+OBJECTS_DIR = obj-bench
+MOC_DIR = tmp-bench
+UI_DIR = tmp-bench
+
+SOURCES -= src/main.cc
+SOURCES += \
+    src/benchmain.cc \
+    src/benchtimer.cc
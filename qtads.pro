@@ -1,4 +1,4 @@
-QT += network svg widgets
+QT += concurrent network svg widgets
 QT_CONFIG -= no-pkg-config
 TEMPLATE = app
 CONFIG += silent warn_off strict_c strict_c++ c11 c++1z gc_binaries
@@ -180,7 +180,9 @@ HEADERS += \
     src/oswin.h \
     src/hos_w32.h \
     src/missing.h \
+    src/benchtimer.h \
     src/globals.h \
+    src/idlegc.h \
     src/sysfont.h \
     src/sysframe.h \
     src/syswinaboutbox.h \
@@ -215,6 +217,7 @@ SOURCES += \
     src/osqt.cc \
     src/hos_qt.cc \
     src/globals.cc \
+    src/idlegc.cc \
     src/sysfont.cc \
     src/sysframe.cc \
     src/syswingroup.cc \
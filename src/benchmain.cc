@@ -0,0 +1,300 @@
+// This is copyrighted software. More information is at the end of this file.
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QKeyEvent>
+#include <QTextStream>
+#include <QTimer>
+#ifdef Q_OS_UNIX
+    #include <sys/resource.h>
+#endif
+
+#include "benchtimer.h"
+#include "globals.h"
+#include "qtadssound.h"
+#include "settings.h"
+#include "sysframe.h"
+#include "syswingroup.h"
+#include "syswininput.h"
+
+#include "vmmain.h"
+
+#if !defined(NO_AUDIO) && defined(main)
+    #undef main
+#endif
+
+/* Headless benchmark driver (see qtads-bench.pro).
+ *
+ * Runs a game in a window of fixed size on the offscreen platform plugin and
+ * feeds it the commands from a script file, one per line (a leading '>' is
+ * ignored, so transcripts recorded by the interpreters work as-is). Every time
+ * the game asks for input, the window is rendered to a QImage and a line with
+ * the time spent parsing, formatting and painting during that turn is
+ * written to stdout, along with the total time of the turn and the peak
+ * resident memory so far. Turn 0 is the game's startup.
+ */
+
+// Peak resident set size of the process, in KB, or -1 if we can't tell.
+static auto peakMemoryKb() -> long
+{
+#ifdef Q_OS_UNIX
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    #ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024;
+    #else
+    return usage.ru_maxrss;
+    #endif
+#else
+    return -1;
+#endif
+}
+
+static auto nsToMs(const qint64 ns) -> double
+{
+    return ns / 1000000.0;
+}
+
+static auto readScript(const QString& filename, QStringList& commands) -> bool
+{
+    QFile file(filename);
+    if (not file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    while (not in.atEnd()) {
+        QString line = in.readLine();
+        if (line.startsWith('>')) {
+            line.remove(0, 1);
+        }
+        commands.append(line);
+    }
+    return true;
+}
+
+namespace {
+class BenchRun final
+{
+public:
+    BenchRun(QStringList commands, QString framesDir)
+        : fCommands(std::move(commands))
+        , fFramesDir(std::move(framesDir))
+        , fOut(stdout)
+    {
+        fOut << "turn\tparse_ms\tformat_ms\tpaint_ms\ttotal_ms\tpeak_kb\tcommand\n";
+    }
+
+    // Connects to the game window of the game that is about to start.
+    void attach()
+    {
+        auto* win = qFrame->gameWindow();
+        QObject::connect(win, &CHtmlSysWinInputQt::inputRequested, [this] { fInputRequested(); });
+        QObject::connect(
+            win, &CHtmlSysWinInputQt::keypressRequested, [this] { fKeypressRequested(); });
+        BenchTimer::reset();
+        fTurnTimer.start();
+    }
+
+    void printSummary()
+    {
+        fOut << "# turns: " << fTurn << '\n'
+             << "# parse_ms: " << nsToMs(fTotals[BenchTimer::Parse]) << '\n'
+             << "# format_ms: " << nsToMs(fTotals[BenchTimer::Format]) << '\n'
+             << "# paint_ms: " << nsToMs(fTotals[BenchTimer::Paint]) << '\n'
+             << "# total_ms: " << nsToMs(fTotalTime) << '\n'
+             << "# peak_kb: " << peakMemoryKb() << '\n';
+        fOut.flush();
+    }
+
+private:
+    QStringList fCommands;
+    QString fFramesDir;
+    QTextStream fOut;
+    QElapsedTimer fTurnTimer;
+    QString fLastCommand = QStringLiteral("(start)");
+    int fTurn = 0;
+    std::array<qint64, BenchTimer::PhaseCount> fTotals{};
+    qint64 fTotalTime = 0;
+
+    void fEndTurn()
+    {
+        // Let pending repaints land in this turn, then render a frame.
+        qFrame->advanceEventLoop(QEventLoop::ExcludeUserInputEvents);
+        QImage frame(qWinGroup->size(), QImage::Format_ARGB32_Premultiplied);
+        qWinGroup->render(&frame);
+        if (not fFramesDir.isEmpty()) {
+            frame.save(fFramesDir + QStringLiteral("/turn-%1.png").arg(fTurn, 4, 10, QChar('0')));
+        }
+
+        const qint64 total = fTurnTimer.nsecsElapsed();
+        fOut << fTurn << '\t' << nsToMs(BenchTimer::total(BenchTimer::Parse)) << '\t'
+             << nsToMs(BenchTimer::total(BenchTimer::Format)) << '\t'
+             << nsToMs(BenchTimer::total(BenchTimer::Paint)) << '\t' << nsToMs(total) << '\t'
+             << peakMemoryKb() << '\t' << fLastCommand << '\n';
+        fOut.flush();
+
+        for (int i = 0; i < BenchTimer::PhaseCount; ++i) {
+            fTotals[i] += BenchTimer::total(static_cast<BenchTimer::Phase>(i));
+        }
+        fTotalTime += total;
+        ++fTurn;
+    }
+
+    void fInputRequested()
+    {
+        fEndTurn();
+
+        // Reply once the input wait is under way.
+        QTimer::singleShot(0, [this] {
+            if (fCommands.isEmpty()) {
+                qFrame->setGameRunning(false);
+                return;
+            }
+            fLastCommand = fCommands.takeFirst();
+            const QByteArray cmd = fLastCommand.toUtf8();
+            BenchTimer::reset();
+            fTurnTimer.start();
+            qFrame->gameWindow()->processCommand(
+                cmd.constData(), cmd.size(), false, true, OS_CMD_NONE);
+        });
+    }
+
+    void fKeypressRequested()
+    {
+        // "Press any key" prompts aren't turns; just dismiss them. If the
+        // script is done, there's no point in going on.
+        QTimer::singleShot(0, [this] {
+            if (fCommands.isEmpty()) {
+                qFrame->setGameRunning(false);
+                return;
+            }
+            auto* e = new QKeyEvent(
+                QEvent::KeyPress, Qt::Key_Space, Qt::NoModifier, QStringLiteral(" "));
+            QCoreApplication::postEvent(qFrame->gameWindow(), e);
+        });
+    }
+};
+} // namespace
+
+auto main(int argc, char** argv) -> int
+{
+    // Unless told otherwise, don't open any windows.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    CHtmlResType::add_basic_types();
+    // Use our own settings, so that benchmark runs don't touch the user's.
+    CHtmlSysFrameQt* app = new CHtmlSysFrameQt(
+        argc, argv, "QTads-bench", QTADS_VERSION, "Nikos Chantziaras", {});
+
+    QCommandLineParser cmdLine;
+    cmdLine.setApplicationDescription(
+        QObject::tr("Replays a command script into a game and reports per-turn timings."));
+    cmdLine.addHelpOption();
+    const QCommandLineOption sizeOpt(
+        QStringLiteral("size"), QObject::tr("Window size (default: 1024x768)."),
+        QStringLiteral("WxH"), QStringLiteral("1024x768"));
+    const QCommandLineOption framesOpt(
+        QStringLiteral("frames"), QObject::tr("Save the frame of every turn as PNG in <dir>."),
+        QStringLiteral("dir"));
+    cmdLine.addOption(sizeOpt);
+    cmdLine.addOption(framesOpt);
+    cmdLine.addPositionalArgument(QStringLiteral("game"), QObject::tr("The game to run."));
+    cmdLine.addPositionalArgument(QStringLiteral("script"), QObject::tr("The commands to enter."));
+    cmdLine.process(*app);
+
+    const QStringList& args = cmdLine.positionalArguments();
+    if (args.size() != 2) {
+        cmdLine.showHelp(1);
+    }
+    const QStringList& dims = cmdLine.value(sizeOpt).split('x');
+    const QSize winSize(
+        dims.size() == 2 ? dims.at(0).toInt() : 0, dims.size() == 2 ? dims.at(1).toInt() : 0);
+    if (winSize.width() <= 0 or winSize.height() <= 0) {
+        qWarning() << "Invalid window size" << cmdLine.value(sizeOpt);
+        delete app;
+        return 1;
+    }
+
+    // The game runs from its own directory, so resolve paths now.
+    const QString gameFileName = QFileInfo(args.at(0)).absoluteFilePath();
+    QStringList commands;
+    if (not readScript(args.at(1), commands)) {
+        qWarning() << "Cannot read script" << args.at(1);
+        delete app;
+        return 1;
+    }
+    QString framesDir;
+    if (cmdLine.isSet(framesOpt)) {
+        framesDir = QDir(cmdLine.value(framesOpt)).absolutePath();
+        QDir().mkpath(framesDir);
+    }
+
+    // Anything that would make the frontend stop and wait for a human would
+    // hang us, and anything that sleeps would skew the timings.
+    const int vmType = vm_get_game_type(
+        QFile::encodeName(gameFileName).constData(), nullptr, 0, nullptr, 0);
+    if (vmType != VM_GGT_TADS2 and vmType != VM_GGT_TADS3) {
+        qWarning() << gameFileName << "is not a TADS game file.";
+        delete app;
+        return 1;
+    }
+    Settings& sett = app->settings();
+    sett.updateFreq = Settings::UpdateNever;
+    sett.softScrolling = false;
+    sett.askForGameFile = false;
+    sett.confirmQuitGame = false;
+    sett.confirmRestartGame = false;
+    app->set_nonstop_mode(true);
+
+#ifndef NO_AUDIO
+    if (not initSound()) {
+        delete app;
+        return 1;
+    }
+#endif
+
+    BenchRun run(std::move(commands), framesDir);
+    QObject::connect(app, &CHtmlSysFrameQt::gameStarting, [&run] { run.attach(); });
+
+    QTimer::singleShot(0, app, [app, &run, winSize, gameFileName] {
+        qWinGroup->resize(winSize);
+        qWinGroup->show();
+        // This returns once the game is over.
+        app->setNextGame(gameFileName);
+        run.printSummary();
+        CHtmlSysFrameQt::exit(0);
+    });
+    int ret = CHtmlSysFrameQt::exec();
+
+    delete app;
+    quitSound();
+    return ret;
+}
+
+/*
+    Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
+
+    This file is part of QTads.
+
+    QTads is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    QTads is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with QTads. If not, see <https://www.gnu.org/licenses/>.
+*/
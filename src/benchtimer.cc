@@ -0,0 +1,71 @@
+// This is copyrighted software. More information is at the end of this file.
+#include "benchtimer.h"
+
+BenchTimer* BenchTimer::fCurrent = nullptr;
+std::array<qint64, BenchTimer::PhaseCount> BenchTimer::fTotals{};
+QElapsedTimer BenchTimer::fClock;
+
+BenchTimer::BenchTimer(const Phase phase)
+    : fPhase(phase)
+    , fOuter(fCurrent)
+{
+    if (not fClock.isValid()) {
+        fClock.start();
+    }
+    fStart = fClock.nsecsElapsed();
+
+    // Pause the enclosing scope.
+    if (fOuter != nullptr) {
+        fTotals[fOuter->fPhase] += fStart - fOuter->fStart;
+    }
+    fCurrent = this;
+}
+
+BenchTimer::~BenchTimer()
+{
+    const qint64 now = fClock.nsecsElapsed();
+    fTotals[fPhase] += now - fStart;
+
+    // Resume the enclosing scope.
+    fCurrent = fOuter;
+    if (fOuter != nullptr) {
+        fOuter->fStart = now;
+    }
+}
+
+auto BenchTimer::total(const Phase phase) -> qint64
+{
+    return fTotals[phase];
+}
+
+void BenchTimer::reset()
+{
+    fTotals.fill(0);
+
+    // Scopes that are still running only count from now on.
+    if (fClock.isValid()) {
+        const qint64 now = fClock.nsecsElapsed();
+        for (auto* timer = fCurrent; timer != nullptr; timer = timer->fOuter) {
+            timer->fStart = now;
+        }
+    }
+}
+
+/*
+    Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
+
+    This file is part of QTads.
+
+    QTads is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    QTads is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with QTads. If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -0,0 +1,69 @@
+// This is copyrighted software. More information is at the end of this file.
+#pragma once
+
+/* Phase timing for the headless benchmark build (qtads-bench.pro).
+ *
+ * BENCH_SCOPE(phase) charges the time until the end of the enclosing block to
+ * the given phase. Scopes may nest; while an inner scope is active, the outer
+ * one is paused, so painting that happens while the formatter spins the event
+ * loop is counted as painting, not formatting. In normal builds the macro
+ * expands to nothing.
+ */
+#ifdef QTADS_BENCHMARK
+#include <QElapsedTimer>
+#include <array>
+
+class BenchTimer final
+{
+public:
+    enum Phase
+    {
+        Parse,
+        Format,
+        Paint,
+        PhaseCount
+    };
+
+    explicit BenchTimer(Phase phase);
+    ~BenchTimer();
+
+    BenchTimer(const BenchTimer&) = delete;
+    auto operator=(const BenchTimer&) -> BenchTimer& = delete;
+
+    // Total time charged to a phase since the last reset, in nanoseconds.
+    static auto total(Phase phase) -> qint64;
+    static void reset();
+
+private:
+    Phase fPhase;
+    BenchTimer* fOuter;
+    qint64 fStart;
+
+    static BenchTimer* fCurrent;
+    static std::array<qint64, PhaseCount> fTotals;
+    static QElapsedTimer fClock;
+};
+
+#define BENCH_SCOPE(phase) BenchTimer benchTimer_(BenchTimer::phase)
+#else
+#define BENCH_SCOPE(phase)
+#endif
+
+/*
+    Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
+
+    This file is part of QTads.
+
+    QTads is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    QTads is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with QTads. If not, see <https://www.gnu.org/licenses/>.
+*/
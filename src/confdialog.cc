@@ -139,6 +139,7 @@ void ConfDialog::fMakeInstantApply()
              ui->writerFontSizeSpinBox,
              ui->inputFontSizeSpinBox,
              ui->limitWidthSpinBox,
+             ui->scrollbackSpinBox,
          })
     {
         connect(
@@ -317,6 +318,7 @@ void ConfDialog::fLoadSettings(const Settings& sett)
         ui->limitWidthCheckBox->setChecked(false);
         ui->limitWidthSpinBox->setEnabled(false);
     }
+    ui->scrollbackSpinBox->setValue(sett.scrollbackMemory);
 
     switch (sett.updateFreq) {
     case Settings::UpdateOnEveryStart:
@@ -413,6 +415,7 @@ void ConfDialog::fApplySettings()
     } else {
         sett.textWidth = 0;
     }
+    sett.scrollbackMemory = ui->scrollbackSpinBox->value();
     if (ui->updateOnStartRadioButton->isChecked()) {
         sett.updateFreq = Settings::UpdateOnEveryStart;
     } else if (ui->updateDailyRadioButton->isChecked()) {
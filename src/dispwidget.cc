@@ -1,15 +1,18 @@
 // This is copyrighted software. More information is at the end of this file.
 #include "dispwidget.h"
 
+#include "benchtimer.h"
 #include "htmlattr.h"
 #include "htmldisp.h"
 #include "htmlfmt.h"
 #include "settings.h"
+#include "syswin.h"
 #include "syswininput.h"
 #include <QClipboard>
 #include <QDebug>
 #include <QDrag>
 #include <QMimeData>
+#include <QPainter>
 #include <QPaintEvent>
 #include <QStatusBar>
 
@@ -52,7 +55,19 @@ void DisplayWidget::fInvalidateLinkTracking()
     qWinGroup->statusBar()->setUpdatesEnabled(true);
 }
 
-auto DisplayWidget::fMySelectedText() const -> QString
+// Number of lines in each block of cached selection text.
+static constexpr long TEXT_BLOCK_LINES = 64;
+
+auto DisplayWidget::fExtractText(
+    const unsigned long startOfs, const unsigned long endOfs, const long firstLine,
+    const long endLine) const -> QString
+{
+    CStringBuf buf;
+    formatter_.extract_line_text(&buf, startOfs, endOfs, firstLine, endLine);
+    return QString::fromUtf8(buf.get());
+}
+
+auto DisplayWidget::fMySelectedText() -> QString
 {
     unsigned long startOfs, endOfs;
     formatter_.get_sel_range(&startOfs, &endOfs);
@@ -61,9 +76,36 @@ auto DisplayWidget::fMySelectedText() const -> QString
         return {};
     }
 
-    CStringBuf buf(formatter_.get_chars_in_ofs_range(startOfs, endOfs));
-    formatter_.extract_text(&buf, startOfs, endOfs);
-    return QString::fromUtf8(buf.get());
+    if (formatter_.get_disp_list_gen() != fTextBlocksGen) {
+        fTextBlocks.clear();
+        fTextBlocksGen = formatter_.get_disp_list_gen();
+    }
+
+    // The blocks that lie entirely inside the selection come from the cache.
+    // Only the partial blocks at either end are extracted every time.
+    const long lineCount = formatter_.get_line_count();
+    const long firstBlock = formatter_.find_line_by_txtofs(startOfs) / TEXT_BLOCK_LINES + 1;
+    const long endBlock = formatter_.find_line_by_txtofs(endOfs) / TEXT_BLOCK_LINES;
+    if (firstBlock >= endBlock) {
+        return fExtractText(startOfs, endOfs, -1, lineCount);
+    }
+
+    auto text = fExtractText(startOfs, endOfs, -1, firstBlock * TEXT_BLOCK_LINES);
+    for (long block = firstBlock; block < endBlock; ++block) {
+        const long firstLine = block * TEXT_BLOCK_LINES;
+        const long endLine = firstLine + TEXT_BLOCK_LINES;
+        const auto blockStart = formatter_.get_line_start_ofs(firstLine);
+        const auto blockEnd = formatter_.get_line_start_ofs(endLine);
+        auto it = fTextBlocks.find(block);
+        if (it == fTextBlocks.end() or it->startOfs != blockStart or it->endOfs != blockEnd) {
+            it = fTextBlocks.insert(
+                block,
+                {blockStart, blockEnd, fExtractText(blockStart, blockEnd, firstLine, endLine)});
+        }
+        text += it->text;
+    }
+    text += fExtractText(startOfs, endOfs, endBlock * TEXT_BLOCK_LINES, lineCount);
+    return text;
 }
 
 void DisplayWidget::fHandleDoubleOrTripleClick(const QMouseEvent& e, const bool tripleClick)
@@ -90,31 +132,166 @@ void DisplayWidget::fHandleDoubleOrTripleClick(const QMouseEvent& e, const bool
         }
     } else if (~QApplication::keyboardModifiers() & Qt::ControlModifier) {
         formatter_.set_sel_range(start, end);
-        fSyncClipboard();
+        fSyncClipboard(fMySelectedText());
         qWinGroup->enableCopyAction(true);
         inSelectMode = true;
         fHasSelection = true;
     }
 }
 
-void DisplayWidget::fSyncClipboard() const
+void DisplayWidget::fSyncClipboard(const QString& text) const
 {
-    const auto text = fMySelectedText();
     if (text.isEmpty() or not QApplication::clipboard()->supportsSelection()) {
         return;
     }
     QApplication::clipboard()->setText(text, QClipboard::Selection);
 }
 
+// Height of the tiles we cache our contents in, and the memory budget for the
+// tiles of a single display widget.
+static constexpr int TILE_HEIGHT = 256;
+static constexpr qint64 TILE_CACHE_BUDGET = 32 * 1024 * 1024;
+
+static auto tileBytes(const QImage& image) -> qint64
+{
+    return static_cast<qint64>(image.bytesPerLine()) * image.height();
+}
+
+auto DisplayWidget::fRenderTile(const int index, const qreal dpr) -> QImage
+{
+    QImage image(QSize(width(), TILE_HEIGHT) * dpr, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(dpr);
+    fPaintTile(image, index, QRect(0, index * TILE_HEIGHT, width(), TILE_HEIGHT));
+    return image;
+}
+
+void DisplayWidget::fPaintTile(QImage& image, const int index, const QRegion& area)
+{
+    const int top = index * TILE_HEIGHT;
+    QPainter painter(&image);
+    painter.translate(0, -top);
+    painter.setClipRegion(area);
+
+    // With a plain background color we can render opaque tiles. A background
+    // image is painted by the viewport and has to show through.
+    const QBrush& bg = palette().brush(backgroundRole());
+    const QRect bounds = area.boundingRect();
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(
+        bounds, bg.style() == Qt::SolidPattern ? bg.color() : QColor(Qt::transparent));
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    // Start out with the same state a painter on the widget itself would.
+    painter.setPen(palette().color(foregroundRole()));
+    painter.setFont(font());
+
+    // The draw callbacks the formatter invokes on our parent all share this
+    // painter. The formatter draws whole lines, so neighbouring text that
+    // overhangs into the area is drawn too, and the clip keeps the rest of
+    // the tile untouched.
+    CHtmlRect cRect(0, bounds.top(), width(), bounds.bottom() + 1);
+    parentSysWin.beginPaint(painter);
+    formatter_.draw(&cRect, false, nullptr);
+    parentSysWin.endPaint();
+}
+
+void DisplayWidget::fEvictTiles(const int firstInUse, const int lastInUse)
+{
+    while (fTileBytes > TILE_CACHE_BUDGET) {
+        auto oldest = fTiles.end();
+        for (auto it = fTiles.begin(); it != fTiles.end(); ++it) {
+            if (it.key() >= firstInUse and it.key() <= lastInUse) {
+                continue;
+            }
+            if (oldest == fTiles.end() or it->lastUse < oldest->lastUse) {
+                oldest = it;
+            }
+        }
+        if (oldest == fTiles.end()) {
+            // Everything left is on screen.
+            return;
+        }
+        fTileBytes -= tileBytes(oldest->image);
+        fTiles.erase(oldest);
+    }
+}
+
+void DisplayWidget::invalidateTiles(const QRect& area)
+{
+    if (area.isNull()) {
+        fTiles.clear();
+        fTileBytes = 0;
+        return;
+    }
+
+    const int first = qMax(area.top(), 0) / TILE_HEIGHT;
+    const int last = qMax(area.bottom(), 0) / TILE_HEIGHT;
+    for (int i = first; i <= last; ++i) {
+        auto it = fTiles.find(i);
+        if (it == fTiles.end()) {
+            continue;
+        }
+        // Small changes, like a status line cell or the input caret, are
+        // painted over the cached tile; only drop tiles that are invalidated
+        // as a whole.
+        const QRect tileRect(0, i * TILE_HEIGHT, width(), TILE_HEIGHT);
+        if (area.contains(tileRect)) {
+            fTileBytes -= tileBytes(it->image);
+            fTiles.erase(it);
+        } else {
+            it->dirty += area.intersected(tileRect);
+        }
+    }
+}
+
 void DisplayWidget::paintEvent(QPaintEvent* const e)
 {
     // qDebug() << Q_FUNC_INFO << "called";
+    BENCH_SCOPE(Paint);
 
     // qDebug() << "repainting" << e->rect();
     const auto qRect = e->region().boundingRect();
-    CHtmlRect cRect(
-        qRect.left(), qRect.top(), qRect.left() + qRect.width(), qRect.top() + qRect.height());
-    formatter_.draw(&cRect, false, nullptr);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    const qreal dpr = devicePixelRatioF();
+#else
+    const qreal dpr = devicePixelRatio();
+#endif
+    const QSize tileSize = QSize(width(), TILE_HEIGHT) * dpr;
+    const int firstTile = qMax(qRect.top(), 0) / TILE_HEIGHT;
+    const int lastTile = qMax(qRect.bottom(), 0) / TILE_HEIGHT;
+
+    // Blit the exposed tiles, rendering the ones we don't have yet.
+    QPainter painter(this);
+    for (int i = firstTile; i <= lastTile; ++i) {
+        auto it = fTiles.find(i);
+        if (it != fTiles.end()
+            and (it->image.size() != tileSize or it->image.devicePixelRatio() != dpr))
+        {
+            fTileBytes -= tileBytes(it->image);
+            fTiles.erase(it);
+            it = fTiles.end();
+        }
+        if (it == fTiles.end()) {
+            it = fTiles.insert(i, {fRenderTile(i, dpr), 0, {}});
+            fTileBytes += tileBytes(it->image);
+        } else if (not it->dirty.isEmpty()) {
+            fPaintTile(it->image, i, it->dirty);
+            it->dirty = {};
+        }
+        it->lastUse = ++fTileClock;
+        painter.drawImage(QPoint(0, i * TILE_HEIGHT), it->image);
+    }
+    fEvictTiles(firstTile, lastTile);
+}
+
+void DisplayWidget::changeEvent(QEvent* const e)
+{
+    // Colors or fonts we rendered with may have changed.
+    if (e->type() == QEvent::PaletteChange or e->type() == QEvent::FontChange) {
+        invalidateTiles();
+        update();
+    }
+    QWidget::changeEvent(e);
 }
 
 void DisplayWidget::mouseMoveEvent(QMouseEvent* const e)
@@ -123,12 +300,12 @@ void DisplayWidget::mouseMoveEvent(QMouseEvent* const e)
     fLastDoubleClick = {};
 
     if (e->buttons() & Qt::LeftButton) {
-        // If we're tracking a selection, update the selection range.
+        // If we're tracking a selection, update the selection range. The
+        // selected text is only extracted once the button is released.
         if (inSelectMode) {
             formatter_.set_sel_range(
                 {fSelectOrigin.x(), fSelectOrigin.y()}, {e->pos().x(), e->pos().y()}, nullptr,
                 nullptr);
-            fSyncClipboard();
             return;
         }
         // We're not tracking a selection, but the mouse is inside of one.
@@ -227,10 +404,12 @@ void DisplayWidget::mouseReleaseEvent(QMouseEvent* const e)
         // Releasing the button ends selection mode.
         inSelectMode = false;
         // If the selection is empty, there would be nothing to copy.
-        if (fMySelectedText().isEmpty()) {
+        const auto text = fMySelectedText();
+        if (text.isEmpty()) {
             qWinGroup->enableCopyAction(false);
         } else {
             fHasSelection = true;
+            fSyncClipboard(text);
         }
         return;
     }
@@ -311,24 +490,13 @@ void DisplayWidget::updateLinkTracking(const QPoint mousePos)
     } else {
         docPos.set(mousePos.x(), mousePos.y());
     }
-    const auto* const disp = formatter_.find_by_pos(docPos, true);
-
-    // If there's nothing, no need to continue.
-    if (disp == nullptr) {
-        // If we were tracking anything, forget about it.
-        if (fHoverLink != nullptr) {
-            fHoverLink->set_clicked(&parentSysWin, CHtmlDispLink_none);
-            fHoverLink = nullptr;
-            unsetCursor();
-            qWinGroup->statusBar()->setUpdatesEnabled(false);
-            qWinGroup->statusBar()->clearMessage();
-            qWinGroup->statusBar()->setUpdatesEnabled(true);
-        }
-        return;
-    }
+    // The formatter's link index knows about everything that reacts to the
+    // mouse (links, ALT text, DIV links), so this avoids scanning the whole
+    // line on every mouse move over link-heavy text.
+    const CHtmlDisp* const disp = formatter_.find_link_by_pos(docPos);
 
     // It could be a link.
-    if (qFrame->settings().enableLinks) {
+    if (disp != nullptr and qFrame->settings().enableLinks) {
         auto* const link = disp->get_link(&formatter_, docPos.x, docPos.y);
 
         // If we're already tracking a hover over this link, we don't need to
@@ -2,6 +2,9 @@
 #pragma once
 #include "config.h"
 #include <QDebug>
+#include <QHash>
+#include <QImage>
+#include <QRegion>
 #include <QTime>
 #include <QWidget>
 
@@ -30,6 +33,10 @@ public:
         fInvalidateLinkTracking();
     }
 
+    // Drop the cached tiles that overlap the given area (in document
+    // coordinates.)  A null rectangle drops all of them.
+    void invalidateTiles(const QRect& area = {});
+
     virtual void clearSelection();
     static auto selectedText() -> QString;
     void updateLinkTracking(QPoint pos);
@@ -44,6 +51,7 @@ protected:
     static DisplayWidget* curSelWidget;
 
     void paintEvent(QPaintEvent* e) override;
+    void changeEvent(QEvent* e) override;
     void mouseMoveEvent(QMouseEvent* e) override;
     void leaveEvent(QEvent* e) override;
     void mousePressEvent(QMouseEvent* e) override;
@@ -61,10 +69,47 @@ private:
     QPoint fDragStartPos;
     QTime fLastDoubleClick;
 
+    // Offscreen cache of our rendered contents.  The document is split into
+    // horizontal tiles of a fixed height, rendered on demand by the formatter
+    // and blitted on repaint.  When the formatter invalidates part of a tile,
+    // only that part is rendered again on the next repaint; a tile that is
+    // invalidated as a whole is dropped.  The least recently used tiles are
+    // evicted once the cache grows past its memory budget.
+    struct Tile
+    {
+        QImage image;
+        quint64 lastUse;
+        QRegion dirty;
+    };
+    QHash<int, Tile> fTiles;
+    quint64 fTileClock = 0;
+    qint64 fTileBytes = 0;
+
+    auto fRenderTile(int index, qreal dpr) -> QImage;
+    void fPaintTile(QImage& image, int index, const QRegion& area);
+    void fEvictTiles(int firstInUse, int lastInUse);
+
+    // Text of the selectable lines, cached in blocks of a fixed number of
+    // lines, so that a large selection only needs the partial blocks at its
+    // ends extracted afresh. A cached block is only used as long as its
+    // lines still start at the same text offsets, and the whole cache is
+    // dropped when the formatter changes any existing display items.
+    struct TextBlock
+    {
+        unsigned long startOfs;
+        unsigned long endOfs;
+        QString text;
+    };
+    QHash<long, TextBlock> fTextBlocks;
+    unsigned long fTextBlocksGen = 0;
+
+    auto fExtractText(unsigned long startOfs, unsigned long endOfs, long firstLine, long endLine) const
+        -> QString;
+
     void fInvalidateLinkTracking();
-    auto fMySelectedText() const -> QString;
+    auto fMySelectedText() -> QString;
     void fHandleDoubleOrTripleClick(const QMouseEvent& e, bool tripleClick);
-    void fSyncClipboard() const;
+    void fSyncClipboard(const QString& text) const;
 };
 
 /*
@@ -0,0 +1,84 @@
+// This is copyrighted software. More information is at the end of this file.
+#include <QElapsedTimer>
+
+#include "globals.h"
+#include "idlegc.h"
+#include "sysframe.h"
+
+#include "vmglob.h"
+#include "vmobj.h"
+
+// How long a single slice of collection work may take, in milliseconds. This
+// is short enough that keystrokes arriving during a slice aren't noticeably
+// delayed.
+constexpr qint64 SLICE_TIME = 2;
+
+IdleGarbageCollector::IdleGarbageCollector()
+{
+    // Only TADS 3 has a collector, and only a running game has a heap.
+    if (not qFrame->tads3() or not qFrame->gameRunning()) {
+        return;
+    }
+    fTimer.setInterval(0);
+    QObject::connect(&fTimer, &QTimer::timeout, &fTimer, [this] { fStep(); });
+    fTimer.start();
+}
+
+IdleGarbageCollector::~IdleGarbageCollector()
+{
+    if (fPassStarted) {
+        fFinish();
+    }
+}
+
+void IdleGarbageCollector::fStep()
+{
+    if (not fPassStarted) {
+        if (not qFrame->gameRunning()) {
+            fTimer.stop();
+            return;
+        }
+        G_obj_table->gc_pass_init(vmg0_);
+        fPassStarted = true;
+    }
+
+    QElapsedTimer sliceTimer;
+    sliceTimer.start();
+    while (G_obj_table->gc_pass_continue(vmg0_)) {
+        if (sliceTimer.elapsed() >= SLICE_TIME) {
+            return;
+        }
+    }
+
+    // The mark phase is done. Sweep now rather than leaving it for later,
+    // since the VM can't resume until the pass is finished anyway.
+    fFinish();
+}
+
+void IdleGarbageCollector::fFinish()
+{
+    fTimer.stop();
+    if (fPassStarted) {
+        G_obj_table->gc_pass_finish(vmg0_);
+        fPassStarted = false;
+    }
+}
+
+/*
+    Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
+
+    This file is part of QTads.
+
+    QTads is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    QTads is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with QTads. If not, see <https://www.gnu.org/licenses/>.
+*/
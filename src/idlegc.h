@@ -0,0 +1,52 @@
+// This is copyrighted software. More information is at the end of this file.
+#pragma once
+#include <QTimer>
+
+/* Runs the TADS 3 garbage collector in small slices while the game waits for
+ * input, so that collection mostly happens while the player is typing rather
+ * than between pressing Enter and seeing the response.
+ *
+ * Create one on the stack around an input wait. Collection work is done from
+ * a zero-interval timer, meaning only when the event loop has nothing else to
+ * do. At most one collection pass is made per wait. The VM must not run while
+ * a pass is in progress, so the destructor completes any unfinished pass
+ * before control returns to the game.
+ */
+class IdleGarbageCollector final
+{
+public:
+    IdleGarbageCollector();
+    ~IdleGarbageCollector();
+
+    IdleGarbageCollector(const IdleGarbageCollector&) = delete;
+    auto operator=(const IdleGarbageCollector&) -> IdleGarbageCollector& = delete;
+
+private:
+    QTimer fTimer;
+    bool fPassStarted = false;
+
+    // Does up to a slice's worth of collection work.
+    void fStep();
+
+    // Completes the current pass and stops collecting for this wait.
+    void fFinish();
+};
+
+/*
+    Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
+
+    This file is part of QTads.
+
+    QTads is free software: you can redistribute it and/or modify it under the
+    terms of the GNU General Public License as published by the Free Software
+    Foundation, either version 3 of the License, or (at your option) any later
+    version.
+
+    QTads is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+    details.
+
+    You should have received a copy of the GNU General Public License along
+    with QTads. If not, see <https://www.gnu.org/licenses/>.
+*/
@@ -5,15 +5,141 @@
 #include "sysimagejpeg.h"
 #include "sysimagemng.h"
 #include "sysimagepng.h"
+#include "sysframe.h"
 #include "syswin.h"
 #include <QBuffer>
 #include <QFileInfo>
+#include <QImageReader>
 #include <QPainter>
+#include <QPixmapCache>
+#include <QtConcurrent>
+#include <optional>
+
+auto QTadsImage::fCachedPixmap(const QSize& size, const Qt::TransformationMode mode, const qreal dpr)
+    const -> QPixmap
+{
+    // cacheKey() changes whenever the image data does, so stale entries are
+    // never hit; they just age out of the cache.
+    const QString key = QStringLiteral("qtads-img:%1:%2x%3:%4:%5")
+                            .arg(cacheKey())
+                            .arg(size.width())
+                            .arg(size.height())
+                            .arg(static_cast<int>(mode))
+                            .arg(dpr);
+    QPixmap pix;
+    if (QPixmapCache::find(key, &pix)) {
+        return pix;
+    }
+
+    if (size == QImage::size()) {
+        pix = QPixmap::fromImage(*this);
+    } else {
+        // Scale to device pixels, so that the result stays sharp on high-DPI
+        // displays.
+        pix = QPixmap::fromImage(scaled(size * dpr, Qt::IgnoreAspectRatio, mode));
+        pix.setDevicePixelRatio(dpr);
+    }
+    QPixmapCache::insert(key, pix);
+    return pix;
+}
+
+QTadsImage::~QTadsImage()
+{
+    // The decoder keeps running if it's busy, but nobody will be notified.
+    if (fDecoder) {
+        fDecoder->disconnect();
+    }
+}
+
+void QTadsImage::decodeAsync(
+    const QByteArray& data, std::shared_ptr<const void> keepAlive, const QByteArray& format,
+    const QSize& headerSize, CHtmlSysWin* win)
+{
+    Q_ASSERT(not fDecoder);
+
+    fHeaderSize = headerSize;
+    fWin = static_cast<CHtmlSysWinQt*>(win);
+    fDecoder = std::make_unique<QFutureWatcher<QImage>>();
+    QObject::connect(
+        fDecoder.get(), &QFutureWatcherBase::finished, fDecoder.get(), [this] { fFinishDecode(); });
+    fDecoder->setFuture(QtConcurrent::run([data, keepAlive, format] {
+        Q_UNUSED(keepAlive);
+        QImage image;
+        image.loadFromData(data, format.constData());
+        return image;
+    }));
+}
+
+void QTadsImage::waitForDecode()
+{
+    if (fDecoder) {
+        fDecoder->waitForFinished();
+        fFinishDecode();
+    }
+}
+
+void QTadsImage::fFinishDecode()
+{
+    if (not fDecoder) {
+        return;
+    }
+    const QImage result = fDecoder->result();
+    // We might be running inside the watcher's own signal.
+    fDecoder->disconnect();
+    fDecoder.release()->deleteLater();
+
+    if (result.isNull()) {
+        qWarning() << "ERROR: Could not parse image data";
+        return;
+    }
+    QImage::operator=(result);
+
+    // Get whatever is showing the placeholder redrawn.
+    const auto placeholders = std::move(fPlaceholders);
+    fPlaceholders.clear();
+    if (fDispSite != nullptr) {
+        fDispSite->dispsite_inval(0, 0, imageWidth(), imageHeight());
+    }
+    for (const auto& placeholder : placeholders) {
+        if (placeholder.first) {
+            const QRect& rect = placeholder.second;
+            CHtmlRect area(rect.left(), rect.top(), rect.right() + 1, rect.bottom() + 1);
+            static_cast<CHtmlSysWinQt*>(placeholder.first.data())->inval_doc_coords(&area);
+        }
+    }
+    if (fDispSite == nullptr and placeholders.isEmpty() and fWin) {
+        CHtmlRect area(0, 0, HTMLSYSWIN_MAX_RIGHT, HTMLSYSWIN_MAX_BOTTOM);
+        static_cast<CHtmlSysWinQt*>(fWin.data())->inval_doc_coords(&area);
+    }
+}
 
 void QTadsImage::drawFromPaintEvent(
     class CHtmlSysWin* win, class CHtmlRect* pos, htmlimg_draw_mode_t mode)
 {
-    QPainter painter(static_cast<CHtmlSysWinQt*>(win)->widget());
+    // Still decoding; there's nothing to draw yet. Remember where we should
+    // have drawn, so that we can get it redrawn when we're done.
+    if (isNull()) {
+        if (fDecoder) {
+            const QPair<QPointer<QObject>, QRect> placeholder(
+                static_cast<CHtmlSysWinQt*>(win),
+                QRect(QPoint(pos->left, pos->top), QPoint(pos->right - 1, pos->bottom - 1)));
+            if (not fPlaceholders.contains(placeholder)) {
+                fPlaceholders.append(placeholder);
+            }
+        }
+        return;
+    }
+
+    // Use the painter of the paint pass we're being called from, if there is
+    // one.
+    auto* sysWin = static_cast<CHtmlSysWinQt*>(win);
+    std::optional<QPainter> localPainter;
+    if (sysWin->activePainter() == nullptr) {
+        localPainter.emplace(sysWin->widget());
+    }
+    QPainter& painter =
+        sysWin->activePainter() != nullptr ? *sysWin->activePainter() : *localPainter;
+    sysWin->resetPainterState();
     if (mode == HTMLIMG_DRAW_CLIP) {
         // Clip mode.  Only draw the part of the image that would fit.  If the
         // image is smaller than pos, adjust the drawing area to avoid scaling.
@@ -33,17 +159,24 @@ void QTadsImage::drawFromPaintEvent(
         return;
     }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    const qreal dpr = painter.device()->devicePixelRatioF();
+#else
+    const qreal dpr = painter.device()->devicePixelRatio();
+#endif
+
     if (mode == HTMLIMG_DRAW_STRETCH) {
         // If the image doesn't fit exactly, scale it. Use the "smooth"
         // transformation mode (which uses a bilinear filter) if enabled in
-        // the settings.
+        // the settings. The scaled result is cached, so we only pay for the
+        // scaling once per target size.
         Qt::TransformationMode mode =
             qFrame->settings().useSmoothScaling ? Qt::SmoothTransformation : Qt::FastTransformation;
         if (width() != pos->right - pos->left or height() != pos->bottom - pos->top) {
-            painter.drawImage(
+            painter.drawPixmap(
                 QPoint(pos->left, pos->top),
-                scaled(
-                    pos->right - pos->left, pos->bottom - pos->top, Qt::IgnoreAspectRatio, mode));
+                fCachedPixmap(
+                    QSize(pos->right - pos->left, pos->bottom - pos->top), mode, dpr));
         } else {
             painter.drawImage(QPoint(pos->left, pos->top), *this);
         }
@@ -52,14 +185,37 @@ void QTadsImage::drawFromPaintEvent(
 
     // If we get here, 'mode' must have been HTMLIMG_DRAW_TILE.
     Q_ASSERT(mode == HTMLIMG_DRAW_TILE);
-    QPixmap pix(QPixmap::fromImage(*this));
     painter.drawTiledPixmap(
-        pos->left, pos->top, pos->right - pos->left, pos->bottom - pos->top, pix);
+        pos->left, pos->top, pos->right - pos->left, pos->bottom - pos->top,
+        fCachedPixmap(size(), Qt::FastTransformation, dpr));
+}
+
+// Returns the 'filesize' bytes at 'seekpos' in the given file. We get a view
+// into the memory-mapped file if possible, and fall back to reading the data.
+static auto readImageData(
+    const QFileInfo& inf, const unsigned long seekpos, const unsigned long filesize)
+    -> MappedResource
+{
+    MappedResource res = qFrame->mapResource(inf.filePath(), seekpos, filesize);
+    if (not res.data.isNull()) {
+        return res;
+    }
+
+    QFile file(inf.filePath());
+    if (not file.open(QIODevice::ReadOnly)) {
+        qWarning() << "ERROR: Can't open file" << inf.filePath();
+        return {};
+    }
+    if (not file.seek(seekpos)) {
+        qWarning() << "ERROR: Can't seek in file" << inf.filePath();
+        return {};
+    }
+    return {file.read(filesize), nullptr};
 }
 
 auto createImageFromFile(
     const CHtmlUrl* /*const url*/, const textchar_t* const filename, const unsigned long seekpos,
-    const unsigned long filesize, CHtmlSysWin* /*const win*/, const QString& imageType)
+    const unsigned long filesize, CHtmlSysWin* const win, const QString& imageType)
     -> CHtmlSysResource*
 {
     // qDebug() << "Loading" << imageType << "image from" << filename << "at offset" << seekpos
@@ -72,18 +228,6 @@ auto createImageFromFile(
         return nullptr;
     }
 
-    // Open the file and seek to the specified position.
-    QFile file(inf.filePath());
-    if (not file.open(QIODevice::ReadOnly)) {
-        qWarning() << "ERROR: Can't open file" << inf.filePath();
-        return nullptr;
-    }
-    if (not file.seek(seekpos)) {
-        qWarning() << "ERROR: Can't seek in file" << inf.filePath();
-        file.close();
-        return nullptr;
-    }
-
     CHtmlSysResource* image = nullptr;
     // Better get an error at compile-time using static_cast rather than an
     // abort at runtime using dynamic_cast.
@@ -103,13 +247,12 @@ auto createImageFromFile(
         mngCast = static_cast<CHtmlSysImageMngQt*>(image);
     } else {
         qWarning() << "ERROR: Unknown image type" << imageType;
-        file.close();
         return nullptr;
     }
 
     // Load the image data.
-    const QByteArray& data(file.read(filesize));
-    file.close();
+    const MappedResource res = readImageData(inf, seekpos, filesize);
+    const QByteArray& data = res.data;
     if (data.isEmpty() or static_cast<unsigned long>(data.size()) < filesize) {
         qWarning() << "ERROR: Could not read" << filesize << "bytes from file" << inf.filePath();
         delete image;
@@ -117,12 +260,26 @@ auto createImageFromFile(
     }
 
     if (imageType == "MNG") {
+        // The movie reads from its device for as long as it plays, so it gets
+        // its own copy rather than a view into the mapping.
         QBuffer* buf = new QBuffer(mngCast);
-        buf->setData(data);
+        buf->setData(res.mapping ? QByteArray(data.constData(), data.size()) : data);
         buf->open(QBuffer::ReadOnly);
         mngCast->setFormat("MNG");
         mngCast->setDevice(buf);
         mngCast->start();
+        return image;
+    }
+
+    // Read the image size from its header, so that the formatter can lay the
+    // image out right away. The actual decoding happens on the thread pool.
+    // If the header can't be read, decode synchronously.
+    QBuffer headerBuf;
+    headerBuf.setData(data);
+    headerBuf.open(QBuffer::ReadOnly);
+    const QSize headerSize = QImageReader(&headerBuf, imageType.toLatin1()).size();
+    if (headerSize.isValid()) {
+        cast->decodeAsync(data, res.mapping, imageType.toLatin1(), headerSize, win);
     } else if (not cast->loadFromData(data, imageType.toLatin1())) {
         qWarning() << "ERROR: Could not parse image data";
         delete image;
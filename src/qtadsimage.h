@@ -1,6 +1,12 @@
 // This is copyrighted software. More information is at the end of this file.
 #pragma once
+#include <QFutureWatcher>
 #include <QImage>
+#include <QList>
+#include <QPair>
+#include <QPixmap>
+#include <QPointer>
+#include <memory>
 
 #include "htmlsys.h"
 
@@ -9,8 +15,33 @@
  */
 class QTadsImage: public QImage
 {
+private:
+    // Returns a pixmap of this image at the given size, converting and scaling
+    // it if needed. Results are kept in the global QPixmapCache, so repaints
+    // of stretched and tiled images don't redo the work.
+    auto fCachedPixmap(const QSize& size, Qt::TransformationMode mode, qreal dpr) const
+        -> QPixmap;
+
+    // Set while the image data is being decoded on the thread pool. Until
+    // the decoder is done, the QImage itself is null; we report the size read
+    // from the image header and draw nothing.
+    std::unique_ptr<QFutureWatcher<QImage>> fDecoder;
+    QSize fHeaderSize;
+
+    // Where to report that decoding finished. The display site is only the
+    // one registered last, so we also remember each area we were asked to
+    // draw while still decoding, in any window, and invalidate all of them.
+    // If there's none of that, we invalidate the whole window the image was
+    // loaded for.
+    class CHtmlSysImageDisplaySite* fDispSite = nullptr;
+    QPointer<QObject> fWin;
+    QList<QPair<QPointer<QObject>, QRect>> fPlaceholders;
+
+    void fFinishDecode();
+
 public:
     QTadsImage() = default;
+    ~QTadsImage();
 
     QTadsImage(const QImage& qImg)
         : QImage(qImg)
@@ -21,6 +52,33 @@ public:
     // through CHtmlFormatter::draw(), which QTadsDisplayWidget::painEvent() is
     // using to repaint the window.
     void drawFromPaintEvent(CHtmlSysWin* win, class CHtmlRect* pos, htmlimg_draw_mode_t mode);
+
+    // Decode 'data' in the background. 'keepAlive' is held until decoding is
+    // done, for when 'data' doesn't own its bytes. 'headerSize' is the size of
+    // the image as read from its header, and is what we report until the
+    // image is ready.
+    void decodeAsync(
+        const QByteArray& data, std::shared_ptr<const void> keepAlive, const QByteArray& format,
+        const QSize& headerSize, CHtmlSysWin* win);
+
+    // Block until a pending background decode has finished.
+    void waitForDecode();
+
+    void setDisplaySite(class CHtmlSysImageDisplaySite* site)
+    {
+        fDispSite = site;
+    }
+
+    // The size of the image, even if it's still being decoded.
+    auto imageWidth() const -> int
+    {
+        return isNull() ? fHeaderSize.width() : width();
+    }
+
+    auto imageHeight() const -> int
+    {
+        return isNull() ? fHeaderSize.height() : height();
+    }
 };
 
 /* Helper routine.  Loads any type of image from the specified offset inside
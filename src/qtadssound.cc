@@ -34,7 +34,10 @@ namespace chrono = std::chrono;
 using namespace std::chrono_literals;
 
 #ifndef NO_AUDIO
-static std::vector<Aulib::Stream*> streamsPendingDeletion;
+// Streams that are still fading out, together with the mapped file they read
+// from (if any.)
+static std::vector<std::pair<Aulib::Stream*, std::shared_ptr<const MappedGameFile>>>
+    streamsPendingDeletion;
 static std::mutex streamsPendingDeletion_mutex;
 #endif
 
@@ -56,8 +59,8 @@ void quitSound()
 #ifndef NO_AUDIO
     {
         std::lock_guard<std::mutex> guard(streamsPendingDeletion_mutex);
-        for (auto* stream : streamsPendingDeletion) {
-            delete stream;
+        for (const auto& pending : streamsPendingDeletion) {
+            delete pending.first;
         }
         streamsPendingDeletion.clear();
     }
@@ -102,7 +105,7 @@ QTadsSound::~QTadsSound()
     fAudStream->unsetLoopCallback();
 
     std::lock_guard<std::mutex> guard(streamsPendingDeletion_mutex);
-    streamsPendingDeletion.push_back(fAudStream);
+    streamsPendingDeletion.emplace_back(fAudStream, std::move(fResourceMapping));
 }
 
 void QTadsSound::fFinishCallback(Aulib::Stream& strm)
@@ -260,35 +263,24 @@ static void deletePendingStreams()
 {
     std::lock_guard<std::mutex> guard(streamsPendingDeletion_mutex);
     const auto streamsCopy = streamsPendingDeletion;
-    for (auto* stream : streamsCopy) {
+    for (const auto& pending : streamsCopy) {
+        auto* stream = pending.first;
         if (!stream->isPlaying()) {
-            const auto pos = std::find(streamsPendingDeletion.begin(), streamsPendingDeletion.end(), stream);
+            const auto pos = std::find_if(
+                streamsPendingDeletion.begin(), streamsPendingDeletion.end(),
+                [stream](const auto& entry) { return entry.first == stream; });
             Q_ASSERT(pos != streamsPendingDeletion.end());
             streamsPendingDeletion.erase(pos);
             delete stream;
         }
     }
 }
-#endif
 
-auto QTadsSound::createSound(
-    const CHtmlUrl* /*url*/, const textchar_t* filename, unsigned long seekpos,
-    unsigned long filesize, CHtmlSysWin*, SoundType type) -> CHtmlSysSound*
-#ifndef NO_AUDIO
+// Opens 'filename', seeks to 'seekpos' and returns an RWops that reads
+// 'filesize' bytes from there.
+static auto openResourceFile(
+    const QFileInfo& inf, const unsigned long seekpos, const unsigned long filesize) -> SDL_RWops*
 {
-    // qDebug() << "Loading sound from" << filename << "offset:" << seekpos << "size:" << filesize
-    //      << "url:" << url->get_url();
-
-    deletePendingStreams();
-
-    // Check if the file exists and is readable.
-    QFileInfo inf(fnameToQStr(filename));
-    if (not inf.exists() or not inf.isReadable()) {
-        qWarning() << "ERROR:" << inf.filePath() << "doesn't exist or is unreadable";
-        return nullptr;
-    }
-
-    // Open the file and seek to the specified position.
     FILE* file = std::fopen(inf.filePath().toLocal8Bit().constData(), "rb");
     if (file == nullptr) {
         int errtmp = errno;
@@ -312,6 +304,44 @@ auto QTadsSound::createSound(
         std::fclose(file);
         return nullptr;
     }
+    return rw;
+}
+#endif
+
+auto QTadsSound::createSound(
+    const CHtmlUrl* /*url*/, const textchar_t* filename, unsigned long seekpos,
+    unsigned long filesize, CHtmlSysWin*, SoundType type) -> CHtmlSysSound*
+#ifndef NO_AUDIO
+{
+    // qDebug() << "Loading sound from" << filename << "offset:" << seekpos << "size:" << filesize
+    //      << "url:" << url->get_url();
+
+    deletePendingStreams();
+
+    // Check if the file exists and is readable.
+    QFileInfo inf(fnameToQStr(filename));
+    if (not inf.exists() or not inf.isReadable()) {
+        qWarning() << "ERROR:" << inf.filePath() << "doesn't exist or is unreadable";
+        return nullptr;
+    }
+
+    // Serve the sound straight from the mapped game file if we can. Otherwise,
+    // open the file and seek to the specified position.
+    MappedResource res = qFrame->mapResource(inf.filePath(), seekpos, filesize);
+    SDL_RWops* rw = nullptr;
+    if (not res.data.isNull()) {
+        rw = SDL_RWFromConstMem(res.data.constData(), res.data.size());
+        if (rw == nullptr) {
+            qWarning() << "ERROR:" << SDL_GetError();
+            SDL_ClearError();
+            return nullptr;
+        }
+    } else {
+        rw = openResourceFile(inf, seekpos, filesize);
+        if (rw == nullptr) {
+            return nullptr;
+        }
+    }
 
     std::unique_ptr<Aulib::Decoder> decoder = nullptr;
     switch (type) {
@@ -369,6 +399,7 @@ auto QTadsSound::createSound(
         sound = new CHtmlSysSoundMidiQt(nullptr, stream, MIDI);
         break;
     }
+    sound->fResourceMapping = std::move(res.mapping);
     stream->setFinishCallback([sound](Aulib::Stream& strm) { sound->fFinishCallback(strm); });
     stream->setLoopCallback([sound](Aulib::Stream& strm) { sound->fLoopCallback(strm); });
     return dynamic_cast<CHtmlSysSound*>(sound);
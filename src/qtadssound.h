@@ -2,6 +2,7 @@
 #pragma once
 #include <QElapsedTimer>
 #include <QObject>
+#include <memory>
 
 #include "config.h"
 #include "qtimerchrono.h"
@@ -10,6 +11,8 @@
     #include "Aulib/Stream.h"
 #endif
 
+struct MappedGameFile;
+
 auto initSound() -> bool;
 
 void quitSound();
@@ -33,6 +36,11 @@ public:
 #ifndef NO_AUDIO
 private:
     Aulib::Stream* fAudStream;
+
+    // The mapped file the stream reads from, if any. The stream outlives us
+    // (it's deleted once it stops playing), so it's handed over along with
+    // the stream on destruction.
+    std::shared_ptr<const MappedGameFile> fResourceMapping;
     SoundType fType;
     bool fPlaying;
     std::chrono::milliseconds fFadeOut{};
@@ -79,6 +79,7 @@ void Settings::loadFromDisk()
     confirmRestartGame = sett.value("confirmrestartgame", confirmRestartGame).toBool();
     confirmQuitGame = sett.value("confirmquitgame", confirmQuitGame).toBool();
     textWidth = sett.value("linewidth", textWidth).toInt();
+    scrollbackMemory = sett.value("scrollbackmemory", scrollbackMemory).toInt();
     lastFileOpenDir = sett.value("lastFileOpenDir", "").toString();
     sett.endGroup();
 
@@ -148,6 +149,7 @@ void Settings::saveToDisk()
     sett.setValue("confirmrestartgame", confirmRestartGame);
     sett.setValue("confirmquitgame", confirmQuitGame);
     sett.setValue("linewidth", textWidth);
+    sett.setValue("scrollbackmemory", scrollbackMemory);
     sett.setValue("lastFileOpenDir", lastFileOpenDir);
     sett.endGroup();
 
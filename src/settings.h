@@ -48,6 +48,9 @@ public:
     bool confirmQuitGame = true;
     QString lastFileOpenDir;
     int textWidth = 70;
+    // How much text (in KB) the main game window keeps before discarding the
+    // oldest.
+    int scrollbackMemory = 64;
 
     QStringList recentGamesList;
     static const int recentGamesCapacity = 10;
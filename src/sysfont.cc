@@ -1,6 +1,165 @@
 // This is copyrighted software. More information is at the end of this file.
 #include "sysfont.h"
 
+#include <QChar>
+#include <climits>
+#include <vector>
+
+// Whether the width of a run containing the given code point is the sum of
+// the advances of its characters. Combining marks, format characters (joiners
+// and bidi controls) and scripts that need complex shaping don't work that
+// way, so we let Qt lay those out.
+static auto hasSimpleShaping(const uint cp) -> bool
+{
+    if (cp < 0x0300) {
+        return true;
+    }
+    if (cp >= 0xD800 and cp <= 0xDFFF) {
+        return false;
+    }
+    if (QChar::isMark(cp) or QChar::category(cp) == QChar::Other_Format) {
+        return false;
+    }
+    switch (QChar::script(cp)) {
+    case QChar::Script_Common:
+    case QChar::Script_Latin:
+    case QChar::Script_Greek:
+    case QChar::Script_Cyrillic:
+    case QChar::Script_Armenian:
+    case QChar::Script_Georgian:
+    case QChar::Script_Han:
+    case QChar::Script_Hiragana:
+    case QChar::Script_Katakana:
+    case QChar::Script_Bopomofo:
+        return true;
+    default:
+        return false;
+    }
+}
+
+auto CHtmlSysFontQt::fAdvance(const uint cp) const -> qreal
+{
+    if (cp < fAsciiAdvances.size()) {
+        auto& adv = fAsciiAdvances[cp];
+        if (adv < 0) {
+            adv = fMetricsForAdvances().width(QString(QChar(cp)));
+        }
+        return adv;
+    }
+
+    auto it = fAdvances.constFind(cp);
+    if (it != fAdvances.constEnd()) {
+        return *it;
+    }
+    return *fAdvances.insert(cp, fMetricsForAdvances().width(QString(QChar(cp))));
+}
+
+auto CHtmlSysFontQt::fKerningFor(const uint prev, const uint cp) const -> qreal
+{
+    const quint64 key = (static_cast<quint64>(prev) << 32) | cp;
+    auto it = fKerning.constFind(key);
+    if (it != fKerning.constEnd()) {
+        return *it;
+    }
+    const QChar pair[] = {QChar(prev), QChar(cp)};
+    const qreal kern =
+        fMetricsForAdvances().width(QString(pair, 2)) - fAdvance(prev) - fAdvance(cp);
+    return *fKerning.insert(key, kern);
+}
+
+auto CHtmlSysFontQt::fWalkRun(
+    const textchar_t* const str, const size_t len, const long maxWidth, int* const width,
+    size_t* const fitLen) const -> bool
+{
+    const bool useKerning = kerning();
+    uint prev = 0;
+    qreal total = 0;
+
+    for (size_t i = 0; i < len;) {
+        const auto c = static_cast<unsigned char>(str[i]);
+        uint cp;
+        size_t charLen;
+        if (c < 0x80) {
+            cp = c;
+            charLen = 1;
+        } else if ((c & 0xE0) == 0xC0 and i + 1 < len and (str[i + 1] & 0xC0) == 0x80) {
+            cp = ((c & 0x1F) << 6) | (str[i + 1] & 0x3F);
+            charLen = 2;
+        } else if (
+            (c & 0xF0) == 0xE0 and i + 2 < len and (str[i + 1] & 0xC0) == 0x80
+            and (str[i + 2] & 0xC0) == 0x80)
+        {
+            cp = ((c & 0x0F) << 12) | ((str[i + 1] & 0x3F) << 6) | (str[i + 2] & 0x3F);
+            charLen = 3;
+        } else {
+            return false;
+        }
+        if (not hasSimpleShaping(cp)) {
+            return false;
+        }
+
+        qreal newTotal = total + fAdvance(cp);
+        if (useKerning and prev != 0) {
+            newTotal += fKerningFor(prev, cp);
+        }
+        if (qRound(newTotal) > maxWidth) {
+            *width = qRound(total);
+            *fitLen = i;
+            return true;
+        }
+        total = newTotal;
+        prev = cp;
+        i += charLen;
+    }
+    *width = qRound(total);
+    *fitLen = len;
+    return true;
+}
+
+auto CHtmlSysFontQt::textWidth(const textchar_t* const str, const size_t len) const -> int
+{
+    int width;
+    size_t fitLen;
+    if (fWalkRun(str, len, LONG_MAX, &width, &fitLen)) {
+        return width;
+    }
+    // Not something we can measure by adding up advances. Measure the whole
+    // run the slow way.
+    return metrics().width(QString::fromUtf8(str, len));
+}
+
+auto CHtmlSysFontQt::charsInWidth(const textchar_t* const str, const size_t len, const long maxWidth)
+    const -> size_t
+{
+    int width;
+    size_t fitLen;
+    if (fWalkRun(str, len, maxWidth, &width, &fitLen)) {
+        return fitLen;
+    }
+
+    // The run needs Qt to shape it. Bisect over the character boundaries
+    // instead, measuring each candidate prefix.
+    std::vector<size_t> ends;
+    for (size_t i = 1; i <= len; ++i) {
+        if (i == len or (str[i] & 0xC0) != 0x80) {
+            ends.push_back(i);
+        }
+    }
+    size_t fit = 0;
+    size_t lo = 0;
+    size_t hi = ends.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (metrics().width(QString::fromUtf8(str, ends[mid])) <= maxWidth) {
+            fit = ends[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return fit;
+}
+
 /*
     Copyright 2003-2020 Nikos Chantziaras <realnc@gmail.com>
 
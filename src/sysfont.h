@@ -3,6 +3,11 @@
 #include <QColor>
 #include <QFontInfo>
 #include <QFontMetrics>
+#include <QFontMetricsF>
+#include <QHash>
+#include <QStringBuilder>
+#include <array>
+#include <optional>
 
 #include "config.h"
 #include "htmlsys.h"
@@ -19,11 +24,82 @@ private:
     QColor fColor;
     QColor fBgColor;
 
+    // Cached metrics and glyph advances. The formatter measures every word it
+    // lays out, so we avoid constructing QFontMetrics and QString objects for
+    // each measurement. Advances are kept unrounded, so that adding them up
+    // gives the same result as laying out the whole run; we only round the
+    // total. Code points below 128 are kept in a flat table (negative means
+    // "not measured yet"), everything else in a hash. Kerning is cached per
+    // character pair as the difference between the pair's width and the sum
+    // of the individual advances.
+    mutable std::optional<QFontMetrics> fMetrics;
+    mutable std::optional<QFontMetricsF> fMetricsF;
+    mutable std::array<qreal, 128> fAsciiAdvances = fEmptyAdvanceTable();
+    mutable QHash<uint, qreal> fAdvances;
+    mutable QHash<quint64, qreal> fKerning;
+
+    static auto fEmptyAdvanceTable() -> std::array<qreal, 128>
+    {
+        std::array<qreal, 128> table;
+        table.fill(-1);
+        return table;
+    }
+
+    auto fMetricsForAdvances() const -> const QFontMetricsF&
+    {
+        if (not fMetricsF) {
+            fMetricsF.emplace(*this);
+        }
+        return *fMetricsF;
+    }
+
+    auto fAdvance(uint cp) const -> qreal;
+    auto fKerningFor(uint prev, uint cp) const -> qreal;
+
+    // Adds up the advances of the UTF-8 run in 'str', stopping before the
+    // first character that would take the width past 'maxWidth'. Stores the
+    // resulting width, rounded to whole pixels, and the number of bytes that
+    // fit. Returns false if the run contains something that can't be measured
+    // by adding up advances, in which case the caller needs to let Qt measure
+    // it.
+    auto fWalkRun(const textchar_t* str, size_t len, long maxWidth, int* width, size_t* fitLen)
+        const -> bool;
+
 public:
     using QFont::QFont;
 
     bool needs_fake_bold = false;
 
+    // Forget all cached metrics. Must be called after changing any attribute
+    // of the font that affects text layout.
+    void invalidateMetricsCache()
+    {
+        fMetrics.reset();
+        fMetricsF.reset();
+        fAsciiAdvances = fEmptyAdvanceTable();
+        fAdvances.clear();
+        fKerning.clear();
+    }
+
+    // Cached font metrics for this font.
+    auto metrics() const -> const QFontMetrics&
+    {
+        if (not fMetrics) {
+            fMetrics.emplace(*this);
+        }
+        return *fMetrics;
+    }
+
+    // Returns the distance from the start of the given UTF-8 run to where
+    // subsequent text should be drawn. This is the same value
+    // QFontMetrics::width() returns for the decoded string, but computed from
+    // cached advances where possible.
+    auto textWidth(const textchar_t* str, size_t len) const -> int;
+
+    // Returns the number of bytes from the start of the given UTF-8 run that
+    // fit in 'maxWidth' pixels. The result is always on a character boundary.
+    auto charsInWidth(const textchar_t* str, size_t len, long maxWidth) const -> size_t;
+
     // When color() is a valid color (QColor::isValid()) it should be used as
     // the foreground color when drawing text in this font.
     auto color() const -> const QColor&
@@ -64,9 +140,21 @@ public:
             and needs_fake_bold == f.needs_fake_bold;
     }
 
+    // A string that is equal for two fonts exactly when operator== says they
+    // are equal. Used to look fonts up in a hash.
+    auto cacheKey() const -> QString
+    {
+        const auto colorKey = [](const QColor& c) {
+            return c.isValid() ? QString::number(c.rgba(), 16) : QString();
+        };
+        return key() % QLatin1Char('/') % colorKey(fColor) % QLatin1Char('/')
+            % colorKey(fBgColor) % QLatin1Char(needs_fake_bold ? 'f' : '-');
+    }
+
     auto operator=(const QFont& f) -> CHtmlSysFontQt&
     {
         QFont::operator=(f);
+        invalidateMetricsCache();
         return *this;
     }
 
@@ -86,7 +174,7 @@ public:
     {
         // qDebug() << Q_FUNC_INFO << "called";
 
-        QFontMetrics tmp(*this);
+        const QFontMetrics& tmp = metrics();
 
         m->ascender_height = tmp.ascent();
         m->descender_height = tmp.descent();
@@ -1,16 +1,19 @@
 // This is copyrighted software. More information is at the end of this file.
 #include <QDebug>
 #include <QDir>
+#include <QFileInfo>
 #include <QFontDatabase>
 #include <QIcon>
 #include <QLabel>
 #include <QLayout>
 #include <QMessageBox>
+#include <QPixmapCache>
 #include <QScreen>
 #include <QStatusBar>
 #include <QTextCodec>
 #include <cstdlib>
 
+#include "benchtimer.h"
 #include "gameinfodialog.h"
 #include "qtadshostifc.h"
 #include "qtadssound.h"
@@ -55,6 +58,29 @@ CHtmlSysFrameQt::CHtmlSysFrameQt(
     // Load our persistent settings.
     fSettings.loadFromDisk();
 
+    fFlushTimer.setSingleShot(true);
+    connect(&fFlushTimer, &QTimer::timeout, this, [this] {
+        if (fGameWin == nullptr) {
+            return;
+        }
+        // Don't format while a window is in the middle of formatting, or the
+        // interpreter is, and is letting the event loop run; try again on the
+        // next frame.
+        if (mustDeferFormatting()) {
+            fFlushTimer.start(16);
+            return;
+        }
+        flushPendingOutput();
+    });
+
+    fReformatTimer.setSingleShot(true);
+    fReformatTimer.setInterval(0);
+    connect(&fReformatTimer, &QTimer::timeout, this, &CHtmlSysFrameQt::runDeferredReformat);
+
+    // Scaled and converted game images are kept in the pixmap cache (see
+    // QTadsImage.) Give it enough room for a few full-window images.
+    QPixmapCache::setCacheLimit(64 * 1024);
+
     // Initialize the input color with the user-configured one.  The game is
     // free to change the input color later on.
     const QColor& tmpCol = fSettings.inputColor;
@@ -189,6 +215,13 @@ void CHtmlSysFrameQt::fRunGame()
             while (not fFontList.isEmpty()) {
                 delete fFontList.takeLast();
             }
+            fFontsByKey.clear();
+            fClearFontLookups();
+
+            // Forget the previous game's file mappings.  Resources that are
+            // still in use keep their mapping alive until they're gone.
+            fMappedFiles.clear();
+            fLooseMappedFiles.clear();
 
             // Recreate them.
             fParser = new CHtmlParser(true);
@@ -270,6 +303,7 @@ void CHtmlSysFrameQt::fRunGame()
 
             // Flush any pending output and cancel all sounds and animations.
             flush_txtbuf(true, false);
+            flushPendingOutput();
             fFormatter->cancel_sound(HTML_Attrib_invalid, 0.0, false, false);
             fFormatter->cancel_playback();
 
@@ -282,6 +316,7 @@ void CHtmlSysFrameQt::fRunGame()
                 "<p><br><font face=tads-serif size=-1>(The game has ended.)</font></p>";
             display_output(endMsg.toUtf8().constData(), endMsg.length());
             flush_txtbuf(true, false);
+            flushPendingOutput();
         } else {
             QMessageBox::critical(
                 fMainWin, tr("Open Game"), finfo.fileName() + tr(" is not a TADS game file."));
@@ -296,6 +331,7 @@ void CHtmlSysFrameQt::fRunT2Game(const QString& fname)
 {
     // We'll be loading a T2 game.
     fTads3 = false;
+    fInitT2Decoder(fSettings.tads2Encoding);
 
     // T2 requires argc/argv style arguments.
     char argv0[] = "qtads";
@@ -403,11 +439,43 @@ static auto find_font_match(const std::vector<QString>& font_names) -> QString
     return qFrame->settings().mainFont.family();
 };
 
+// Returns a key that is equal for two font descriptors exactly when createFont()
+// would resolve them the same way.
+static auto fontDescKey(const CHtmlFontDesc& desc) -> QByteArray
+{
+    const int flags = (desc.italic ? 1 << 0 : 0) | (desc.underline ? 1 << 1 : 0)
+        | (desc.strikeout ? 1 << 2 : 0) | (desc.default_color ? 1 << 3 : 0)
+        | (desc.default_bgcolor ? 1 << 4 : 0) | (desc.face_set_explicitly ? 1 << 5 : 0)
+        | (desc.fixed_pitch ? 1 << 6 : 0) | (desc.serif ? 1 << 7 : 0) | (desc.pe_big ? 1 << 8 : 0)
+        | (desc.pe_small ? 1 << 9 : 0) | (desc.pe_em ? 1 << 10 : 0)
+        | (desc.pe_strong ? 1 << 11 : 0) | (desc.pe_dfn ? 1 << 12 : 0)
+        | (desc.pe_code ? 1 << 13 : 0) | (desc.pe_samp ? 1 << 14 : 0)
+        | (desc.pe_kbd ? 1 << 15 : 0) | (desc.pe_var ? 1 << 16 : 0)
+        | (desc.pe_cite ? 1 << 17 : 0) | (desc.pe_address ? 1 << 18 : 0);
+    const int fields[] = {
+        desc.pointsize,
+        desc.weight,
+        desc.htmlsize,
+        flags,
+        desc.default_color ? 0 : static_cast<int>(desc.color),
+        desc.default_bgcolor ? 0 : static_cast<int>(desc.bgcolor)};
+
+    QByteArray key(reinterpret_cast<const char*>(fields), sizeof(fields));
+    key.append(desc.face);
+    return key;
+}
+
 auto CHtmlSysFrameQt::createFont(const CHtmlFontDesc* font_desc) -> CHtmlSysFontQt*
 {
     // qDebug() << Q_FUNC_INFO;
     Q_ASSERT(font_desc != nullptr);
 
+    // If we've seen this descriptor before, we already know its font.
+    const QByteArray descKey = fontDescKey(*font_desc);
+    if (auto* cached_font = fFontsByDesc.value(descKey)) {
+        return cached_font;
+    }
+
     CHtmlFontDesc newFontDesc = *font_desc;
     int weight = QFont::Normal;
     bool use_italic = newFontDesc.italic;
@@ -608,24 +676,83 @@ auto CHtmlSysFrameQt::createFont(const CHtmlFontDesc* font_desc) -> CHtmlSysFont
     }
 
     // Some fonts don't have a bold version, and on some platforms Qt does not support synthesizing
-    // a bold variant. We need to take care of things ourselves in that case.
-    if (new_font.weight() >= QFont::Bold and QFontInfo(new_font).weight() < QFont::Bold) {
-        new_font.needs_fake_bold = true;
+    // a bold variant. We need to take care of things ourselves in that case. Resolving the font
+    // through QFontInfo is expensive, so we only do it once per family and style.
+    if (new_font.weight() >= QFont::Bold) {
+        const QString faceKey = new_font.family() % QLatin1Char('/')
+            % QString::number(new_font.weight()) % QLatin1Char(new_font.italic() ? 'i' : 'r');
+        auto fakeBold = fFakeBoldFaces.constFind(faceKey);
+        if (fakeBold == fFakeBoldFaces.constEnd()) {
+            fakeBold = fFakeBoldFaces.insert(faceKey, QFontInfo(new_font).weight() < QFont::Bold);
+        }
+        new_font.needs_fake_bold = *fakeBold;
     }
 
     // Check whether a matching font is already in our cache.
-    for (auto* cached_font : fFontList) {
-        if (*cached_font == new_font) {
-            return cached_font;
+    const QString fontKey = new_font.cacheKey();
+    CHtmlSysFontQt* font = fFontsByKey.value(fontKey);
+    if (font == nullptr) {
+        // There was no match in our cache. Create a new font and store it in
+        // our cache.
+        font = new CHtmlSysFontQt(new_font);
+        font->set_font_desc(&newFontDesc);
+        fFontList.append(font);
+        fFontsByKey.insert(fontKey, font);
+    }
+    fFontsByDesc.insert(descKey, font);
+    return font;
+}
+
+auto CHtmlSysFrameQt::fIsGameBundle(const QFileInfo& file) const -> bool
+{
+    if (fGameFile.isEmpty()) {
+        return false;
+    }
+    const QFileInfo game(fGameFile);
+    if (file.absoluteFilePath() == game.absoluteFilePath()) {
+        return true;
+    }
+
+    // TADS 3 bundles are named .3r0 to .3r9, TADS 2 ones .rs0 to .rs9.
+    const QString suffix = file.suffix().toLower();
+    return file.absolutePath() == game.absolutePath()
+        and file.completeBaseName() == game.completeBaseName() and suffix.size() == 3
+        and (suffix.startsWith(QLatin1String("3r")) or suffix.startsWith(QLatin1String("rs")))
+        and suffix.at(2).isDigit();
+}
+
+auto CHtmlSysFrameQt::mapResource(const QString& filename, qint64 offset, qint64 size)
+    -> MappedResource
+{
+    const QFileInfo inf(filename);
+    const QString path = inf.absoluteFilePath();
+    const bool isBundle = fIsGameBundle(inf);
+    auto mapping = isBundle ? fMappedFiles.value(path) : fLooseMappedFiles.value(path).lock();
+    if (not mapping) {
+        auto newMapping = std::make_shared<MappedGameFile>();
+        newMapping->file.setFileName(path);
+        if (not newMapping->file.open(QIODevice::ReadOnly)) {
+            return {};
+        }
+        newMapping->size = newMapping->file.size();
+        newMapping->data = newMapping->file.map(0, newMapping->size);
+        if (newMapping->data == nullptr) {
+            return {};
+        }
+        mapping = std::move(newMapping);
+        if (isBundle) {
+            fMappedFiles.insert(path, mapping);
+        } else {
+            fLooseMappedFiles.insert(path, mapping);
         }
     }
 
-    // There was no match in our cache. Create a new font and store it in our
-    // cache.
-    CHtmlSysFontQt* font = new CHtmlSysFontQt(new_font);
-    font->set_font_desc(&newFontDesc);
-    fFontList.append(font);
-    return font;
+    if (offset < 0 or size <= 0 or offset + size > mapping->size) {
+        return {};
+    }
+    return {
+        QByteArray::fromRawData(reinterpret_cast<const char*>(mapping->data) + offset, size),
+        std::move(mapping)};
 }
 
 void CHtmlSysFrameQt::adjustBannerSizes()
@@ -646,22 +773,63 @@ void CHtmlSysFrameQt::reformatBanners(bool showStatus, bool freezeDisplay, bool
         return;
     }
 
+    // Restarting a window that's still formatting would pull its formatter
+    // out from under it.  Remember the request; the window will run it when
+    // it's done.  The same goes for the interpreter; we run the reformat at
+    // the latest when it asks for input.
+    if (mustDeferFormatting()) {
+        fDeferredShowStatus = fDeferredShowStatus or showStatus;
+        fDeferredFreezeDisplay = fDeferredFreezeDisplay or freezeDisplay;
+        fDeferredResetSounds = fDeferredResetSounds or resetSounds;
+        fReformatDeferred = true;
+        return;
+    }
+
     // Recalculate the banner layout, in case any of the underlying units (such
     // as the default font size) changed.
     adjustBannerSizes();
 
-    // Always reformat the main panel window.
-    fGameWin->doReformat(showStatus, freezeDisplay, resetSounds);
-
-    // Reformat each banner window.
+    // Reformat the main panel window and the banners whose layout is out of
+    // date.  The rest keep their current layout.
+    if (fGameWin->pendingReformat()) {
+        fGameWin->doReformat(showStatus, freezeDisplay, resetSounds);
+    }
     for (int i = 0; i < fBannerList.size(); ++i) {
-        fBannerList.at(i)->doReformat(showStatus, freezeDisplay, false);
+        if (fBannerList.at(i)->pendingReformat()) {
+            fBannerList.at(i)->doReformat(showStatus, freezeDisplay, false);
+        }
+    }
+}
+
+auto CHtmlSysFrameQt::isFormatting() const -> bool
+{
+    if (fGameWin != nullptr and fGameWin->isFormatting()) {
+        return true;
+    }
+    for (const auto* banner : fBannerList) {
+        if (banner->isFormatting()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CHtmlSysFrameQt::runDeferredReformat()
+{
+    if (not fReformatDeferred or mustDeferFormatting()) {
+        return;
     }
+    const bool showStatus = fDeferredShowStatus;
+    const bool freezeDisplay = fDeferredFreezeDisplay;
+    const bool resetSounds = fDeferredResetSounds;
+    fReformatDeferred = fDeferredShowStatus = fDeferredFreezeDisplay = fDeferredResetSounds = false;
+    reformatBanners(showStatus, freezeDisplay, resetSounds);
 }
 
 void CHtmlSysFrameQt::pruneParseTree()
 {
-    static int checkCount = 0;
+    // Catch up on any reformat that had to wait.
+    runDeferredReformat();
 
     // If there's a reformat pending, perform it.
     if (fReformatPending) {
@@ -669,27 +837,35 @@ void CHtmlSysFrameQt::pruneParseTree()
         reformatBanners(true, true, false);
     }
 
-    // Skip this entirely most of the time; only check every so often, so that
-    // we don't waste a lot of time doing this too frequently.
-    ++checkCount;
-    if (checkCount < 10) {
-        return;
-    }
-    checkCount = 0;
-
     // Check to see if we're consuming too much memory - if not, there's
-    // nothing we need to do here.
-    if (fParser->get_text_array()->get_mem_in_use() < 65536) {
+    // nothing we need to do here.  Keeping track of the memory in use is the
+    // text array's job, so this check is cheap enough to do every time.
+    const unsigned long budget = static_cast<unsigned long>(fSettings.scrollbackMemory) * 1024;
+    if (fParser->get_text_array()->get_mem_in_use() < budget) {
         return;
     }
 
-    // Perform the pruning and reformat all banners.
-    fParser->prune_tree(65536 / 2);
+    // Perform the pruning and reformat the main window.  Banners have parsers
+    // of their own and aren't affected.  We cut down to half the budget, so
+    // that this doesn't happen again after just a few more turns.  Every
+    // reformat re-lays out whatever survives the prune, so the default budget
+    // stays small; raising it trades reformat speed for scrollback.
+    fParser->prune_tree(budget / 2);
+    fGameWin->markForReformat();
     reformatBanners(false, true, false);
 }
 
 void CHtmlSysFrameQt::notifyPreferencesChange(const Settings& sett)
 {
+    // Font settings might have changed, so descriptors need to be resolved
+    // again.
+    fClearFontLookups();
+
+    // Same for the TADS 2 output encoding.
+    if (fT2Decoder and sett.tads2Encoding != fT2Encoding) {
+        fInitT2Decoder(sett.tads2Encoding);
+    }
+
     // Bail out if we currently don't have an active formatter.
     if (fFormatter == nullptr) {
         return;
@@ -720,6 +896,10 @@ void CHtmlSysFrameQt::notifyPreferencesChange(const Settings& sett)
 
     // Reformat everything so that changes in fonts/colors/etc become visible
     // immediately.
+    fGameWin->markForReformat();
+    for (auto* banner : fBannerList) {
+        banner->markForReformat();
+    }
     qFrame->reformatBanners(true, true, false);
 
     // Change the text cursor's height according to the new input font's height.
@@ -740,24 +920,74 @@ auto CHtmlSysFrame::eof_on_console() -> int
 
 void CHtmlSysFrameQt::flush_txtbuf(int fmt, int immediate_redraw)
 {
-    // Flush and clear the buffer.
-    fParser->parse(&fBuffer, qWinGroup);
+    // Flush and clear the buffer.  Parsing always happens right away, since
+    // the caller might be about to change the parsing mode.
+    {
+        BENCH_SCOPE(Parse);
+        fParser->parse(&fBuffer, qWinGroup);
+    }
     fBuffer.clear();
 
-    // If desired, run the parsed source through the formatter and display it.
-    if (fmt) {
-        fGameWin->do_formatting(false, false, false);
+    if (not fmt) {
+        // Also flush all banner windows.
+        for (int i = 0; i < fBannerList.size(); ++i) {
+            fBannerList.at(i)->get_formatter()->flush_txtbuf(false);
+        }
+
+        // If desired, immediately update the display.
+        if (immediate_redraw) {
+            fMainWin->centralWidget()->update();
+        }
+        return;
+    }
+
+    fFormatPending = true;
+    fRedrawPending = fRedrawPending or immediate_redraw;
+
+    // If we already formatted during the current display frame, there's no
+    // point in doing it again before the frame is shown; leave it to the
+    // flush timer.  The caller wants to see the output right away if it asked
+    // for an immediate redraw (os_update_display() does), so we don't wait in
+    // that case.  We can't format while a window is in the middle of
+    // formatting though.
+    const QScreen* screen = primaryScreen();
+    const qreal refreshRate = screen != nullptr and screen->refreshRate() > 0
+        ? screen->refreshRate()
+        : 60.0;
+    const qint64 frameTime = qMax(qRound64(1000.0 / refreshRate), qint64(1));
+    const bool recentlyFormatted =
+        fLastFormatTime.isValid() and fLastFormatTime.elapsed() < frameTime;
+    if ((recentlyFormatted and not immediate_redraw) or isFormatting()) {
+        ++fCoalescedFlushes;
+        if (not fFlushTimer.isActive()) {
+            fFlushTimer.start(
+                recentlyFormatted ? static_cast<int>(frameTime - fLastFormatTime.elapsed()) : 0);
+        }
+        return;
     }
+    fFormatPendingOutput();
+}
+
+void CHtmlSysFrameQt::fFormatPendingOutput()
+{
+    BENCH_SCOPE(Format);
+    fFormatPending = false;
+    fFlushTimer.stop();
+
+    // Run the parsed source through the formatter and display it.
+    fGameWin->do_formatting(false, false, false);
 
     // Also flush all banner windows.
     for (int i = 0; i < fBannerList.size(); ++i) {
-        fBannerList.at(i)->get_formatter()->flush_txtbuf(fmt);
+        fBannerList.at(i)->get_formatter()->flush_txtbuf(true);
     }
 
     // If desired, immediately update the display.
-    if (immediate_redraw) {
+    if (fRedrawPending) {
+        fRedrawPending = false;
         fMainWin->centralWidget()->update();
     }
+    fLastFormatTime.start();
 }
 
 void CHtmlSysFrameQt::start_new_page()
@@ -771,6 +1001,7 @@ void CHtmlSysFrameQt::start_new_page()
 
     // Flush any pending output.
     flush_txtbuf(true, false);
+    flushPendingOutput();
 
     // Cancel all animations.
     fFormatter->cancel_playback();
@@ -787,6 +1018,7 @@ void CHtmlSysFrameQt::start_new_page()
     fGameWin->notify_clear_contents();
 
     // Reformat the window for the new blank page.
+    fGameWin->markForReformat();
     reformatBanners(false, false, true);
 }
 
@@ -807,8 +1039,89 @@ void CHtmlSysFrameQt::display_output(const textchar_t* buf, size_t len)
         fBuffer.append(buf, len);
     } else {
         // TADS 2 does not use UTF-8; use the encoding from our settings.
-        QTextCodec* codec = QTextCodec::codecForName(fSettings.tads2Encoding);
-        fBuffer.append(codec->toUnicode(buf, len).toUtf8().constData());
+        fDisplayT2Output(buf, len);
+    }
+
+    // Games that print while they compute would otherwise keep the window
+    // from repainting until they're done. TADS 3 has no other periodic hook
+    // we could use.
+    yieldToEventLoop();
+}
+
+void CHtmlSysFrameQt::fInitT2Decoder(const QByteArray& encoding)
+{
+    QTextCodec* codec = QTextCodec::codecForName(encoding);
+    if (codec == nullptr) {
+        codec = QTextCodec::codecForName("windows-1252");
+    }
+    fT2Encoding = encoding;
+    fT2Decoder.reset(codec->makeDecoder());
+
+    // Find out whether every byte decodes to a character on its own, no matter
+    // what follows it. If so, the encoding is single-byte and we can convert
+    // through a table.
+    fT2SingleByte = codec->mibEnum() != 106; // UTF-8
+    for (int i = 0; i < 256 and fT2SingleByte; ++i) {
+        const QByteArray byte(1, static_cast<char>(i));
+        const QString str = codec->toUnicode(byte);
+        const QByteArray utf8 = str.toUtf8();
+        if (str.size() != 1 or utf8.size() > 3) {
+            fT2SingleByte = false;
+            break;
+        }
+        for (const char next : {'a', '\xA9'}) {
+            const QByteArray nextByte(1, next);
+            if (codec->toUnicode(QByteArray(byte).append(next))
+                != QString(str).append(codec->toUnicode(nextByte))) {
+                fT2SingleByte = false;
+                break;
+            }
+        }
+        if (not fT2SingleByte) {
+            break;
+        }
+        std::copy(utf8.cbegin(), utf8.cend(), fT2Utf8[i].begin());
+        fT2Utf8[i][3] = static_cast<char>(utf8.size());
+    }
+}
+
+void CHtmlSysFrameQt::fDisplayT2Output(const char* buf, size_t len)
+{
+    if (not fT2Decoder) {
+        fInitT2Decoder(fSettings.tads2Encoding);
+    }
+
+    const char* const end = buf + len;
+    while (buf < end) {
+        // Copy runs of ASCII straight through. For multibyte encodings, that's
+        // only safe if we're not in the middle of a sequence.
+        const char* run = buf;
+        if (fT2SingleByte
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+            or not fT2Decoder->needsMoreData()
+#endif
+        ) {
+            while (run < end and static_cast<unsigned char>(*run) < 0x80) {
+                ++run;
+            }
+        }
+        if (run > buf) {
+            fBuffer.append(buf, run - buf);
+            buf = run;
+            continue;
+        }
+
+        if (not fT2SingleByte) {
+            // Let the decoder handle the rest. It keeps any incomplete
+            // sequence at the end around for the next call.
+            const QByteArray& utf8 = fT2Decoder->toUnicode(buf, end - buf).toUtf8();
+            fBuffer.append(utf8.constData(), utf8.size());
+            return;
+        }
+
+        const auto& seq = fT2Utf8[static_cast<unsigned char>(*buf)];
+        fBuffer.append(seq.data(), static_cast<size_t>(seq[3]));
+        ++buf;
     }
 }
 
@@ -816,6 +1129,10 @@ auto CHtmlSysFrameQt::check_break_key() -> int
 {
     // qDebug() << Q_FUNC_INFO;
 
+    // TADS 2 calls this every so often while running game code, which gives
+    // us a chance to keep the GUI responsive.
+    yieldToEventLoop();
+
     // TODO: We don't check for any such shortcut yet.
     return false;
 }
@@ -837,6 +1154,7 @@ auto CHtmlSysFrameQt::get_input_timeout(
 
     // Flush and prune before input.
     flush_txtbuf(true, false);
+    flushPendingOutput();
     pruneParseTree();
 
     if (use_timeout) {
@@ -869,6 +1187,7 @@ auto CHtmlSysFrameQt::get_input_event(unsigned long timeout, int use_timeout, os
 
     // Flush and prune before input.
     flush_txtbuf(true, false);
+    flushPendingOutput();
     pruneParseTree();
 
     // Get the input.
@@ -1,11 +1,39 @@
 // This is copyrighted software. More information is at the end of this file.
 #pragma once
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QTimer>
+#include <array>
+#include <memory>
 
 #include "config.h"
 #include "htmlsys.h"
 #include "settings.h"
 
+/* A game or resource file mapped into memory.  Images and sounds embedded in
+ * it are handed out as views into the mapping instead of being read into
+ * buffers of their own.
+ */
+struct MappedGameFile
+{
+    // Kept open for as long as the mapping is in use.
+    QFile file;
+    const uchar* data = nullptr;
+    qint64 size = 0;
+};
+
+/* A view of a resource embedded in a mapped file.  'data' doesn't own its
+ * bytes; they stay valid for as long as 'mapping' is kept alive.
+ */
+struct MappedResource
+{
+    QByteArray data;
+    std::shared_ptr<const MappedGameFile> mapping;
+};
+
 /* Tads HTML layer class whose interface needs to be implemented by the
  * interpreter.
  *
@@ -29,6 +57,22 @@ private:
 
     class CHtmlTextBuffer fBuffer;
 
+    // Converts TADS 2 output from the game's encoding to UTF-8. Set up once
+    // per game (and again if the encoding setting changes) by
+    // fInitT2Decoder(). For single-byte encodings, fT2Utf8 holds the UTF-8
+    // sequence of every byte value (its length in the last element), so that
+    // output can be converted without going through QString. Other encodings
+    // go through fT2Decoder, which keeps multibyte sequences that are split
+    // across output calls.
+    QByteArray fT2Encoding;
+    std::unique_ptr<class QTextDecoder> fT2Decoder;
+    std::array<std::array<char, 4>, 256> fT2Utf8{};
+    bool fT2SingleByte = false;
+
+    void fInitT2Decoder(const QByteArray& encoding);
+
+    void fDisplayT2Output(const char* buf, size_t len);
+
     // Main window.
     class CHtmlSysWinGroupQt* fMainWin;
 
@@ -51,9 +95,46 @@ private:
     // responsible for deleting them when they're no longer needed.
     QList<class CHtmlSysFontQt*> fFontList;
 
+    // Indexes into fFontList. The formatter asks for a font every time the
+    // text attributes change, so lookups need to be cheap. fFontsByDesc maps
+    // font descriptors we've seen before straight to their font, without
+    // building any Qt font objects. fFontsByKey maps fonts by their resolved
+    // attributes (CHtmlSysFontQt::cacheKey()), so that different descriptors
+    // resolving to the same font share it. fFakeBoldFaces remembers, per
+    // family and style, whether bold needs to be synthesized.
+    QHash<QByteArray, class CHtmlSysFontQt*> fFontsByDesc;
+    QHash<QString, class CHtmlSysFontQt*> fFontsByKey;
+    QHash<QString, bool> fFakeBoldFaces;
+
+    // Forgets which fonts descriptors resolve to, for when the font settings
+    // change.
+    void fClearFontLookups()
+    {
+        fFontsByDesc.clear();
+        fFakeBoldFaces.clear();
+    }
+
+    // The game file and its resource bundles, mapped into memory, by absolute
+    // path.  These stay mapped until the game ends.
+    QHash<QString, std::shared_ptr<const MappedGameFile>> fMappedFiles;
+
+    // Other resource files we mapped, by absolute path.  A game can use any
+    // number of these, so we don't keep them open; each one is unmapped when
+    // the last resource using it is gone.
+    QHash<QString, std::weak_ptr<const MappedGameFile>> fLooseMappedFiles;
+
+    // Is the file the game file or one of its external resource bundles?
+    auto fIsGameBundle(const QFileInfo& file) const -> bool;
+
     // Are we currently executing a game?
     bool fGameRunning;
 
+    // Time since we last let the GUI process events from yieldToEventLoop().
+    QElapsedTimer fYieldTimer;
+
+    // Are we processing events from within an interpreter callback?
+    bool fYielding = false;
+
     // Filename of the game we're currently executing.
     QString fGameFile;
 
@@ -67,6 +148,28 @@ private:
     // Is there a reformat pending?
     bool fReformatPending;
 
+    // A reformatBanners() request that came in while a window was formatting
+    // and had to wait for it to finish.  The arguments of all such requests
+    // are merged.
+    bool fReformatDeferred = false;
+    bool fDeferredShowStatus = false;
+    bool fDeferredFreezeDisplay = false;
+    bool fDeferredResetSounds = false;
+    QTimer fReformatTimer;
+
+    // Output coalescing.  Games that print in tight loops flush far more often
+    // than the display refreshes, so flush_txtbuf() formats and redraws at
+    // most once per display frame.  Flushes in between only parse the text
+    // and leave the formatting to fFlushTimer (or to the next input request,
+    // which calls flushPendingOutput().)
+    bool fFormatPending = false;
+    bool fRedrawPending = false;
+    QElapsedTimer fLastFormatTime;
+    QTimer fFlushTimer;
+    quint64 fCoalescedFlushes = 0;
+
+    void fFormatPendingOutput();
+
     // Current input font color.
     HTML_color_t fInputColor;
 
@@ -143,6 +246,13 @@ public:
 
     auto createFont(const CHtmlFontDesc* font_desc) -> CHtmlSysFontQt*;
 
+    // Returns a view of the 'size' bytes at 'offset' in the given file,
+    // mapping the file into memory if it isn't already.  Returns a null
+    // 'data' if the file can't be mapped or the range is out of bounds.
+    // Files other than the game and its bundles are only kept mapped for as
+    // long as a resource from them is in use.
+    auto mapResource(const QString& filename, qint64 offset, qint64 size) -> MappedResource;
+
     auto gameRunning() -> bool
     {
         return fGameRunning;
@@ -186,9 +296,51 @@ public:
     // Recalculate and adjust the sizes of all HTML banners.
     void adjustBannerSizes();
 
-    // Reformat all HTML banners.
+    // Reformat all HTML banners.  If a window is in the middle of formatting
+    // (and is letting the event loop run), or the interpreter is, the
+    // reformat is deferred until it's done.
     void reformatBanners(bool showStatus, bool freezeDisplay, bool resetSounds);
 
+    // Is the main game window or any banner in the middle of formatting?
+    auto isFormatting() const -> bool;
+
+    // Do reformats and output formatting have to wait?  That's the case while
+    // a window is formatting, and while we're letting the GUI process events
+    // from within an interpreter callback.
+    auto mustDeferFormatting() const -> bool
+    {
+        return fYielding or isFormatting();
+    }
+
+    // Perform a reformat that reformatBanners() had to defer, if no window is
+    // formatting anymore.
+    void runDeferredReformat();
+
+    // Run a deferred reformat from the event loop.  Windows call this when
+    // they're done formatting.
+    void scheduleDeferredReformat()
+    {
+        if (fReformatDeferred) {
+            fReformatTimer.start();
+        }
+    }
+
+    // Format and display any output whose formatting was deferred by
+    // flush_txtbuf().  Must be called before anything that relies on the
+    // formatted state of the windows, such as waiting for input.
+    void flushPendingOutput()
+    {
+        if (fFormatPending) {
+            fFormatPendingOutput();
+        }
+    }
+
+    // Number of flushes whose formatting was merged into a later one.
+    auto coalescedFlushes() const -> quint64
+    {
+        return fCoalescedFlushes;
+    }
+
     // Schedule a reformat.
     void scheduleReformat()
     {
@@ -198,8 +350,8 @@ public:
     // Prune the main window's parse tree, if we're using too much memory.
     // This should be called before getting user input; we'll check to see how
     // much memory the parse tree is taking up, and cut it down a bit if it's
-    // too big.
-    // TODO: Implement configurable max memory size.
+    // more than the scrollback memory set in the preferences.  The text that
+    // is cut is gone for good; it isn't kept anywhere to scroll back to.
     void pruneParseTree();
 
     // Notify the application that preferences have changed.
@@ -229,6 +381,24 @@ public:
         working = false;
     }
 
+    // Let the GUI repaint if the game has kept it waiting for longer than a
+    // frame. Called from the callbacks the interpreters make while running
+    // game code (the TADS 2 break check and game output), so that output
+    // shows up during long computations. User input stays queued until the
+    // game asks for it. The interpreter is in the middle of a callback, so
+    // reformats and output flushes that come up while we're in here (from a
+    // resize or the flush timer) are put off until it's done.
+    void yieldToEventLoop()
+    {
+        if (fYieldTimer.isValid() and fYieldTimer.elapsed() < 16) {
+            return;
+        }
+        fYielding = true;
+        advanceEventLoop(QEventLoop::ExcludeUserInputEvents);
+        fYielding = false;
+        fYieldTimer.start();
+    }
+
     // Advance the event loop with a timeout.
     void advanceEventLoop(QEventLoop::ProcessEventsFlags flags, int maxtime)
     {
@@ -20,14 +20,19 @@ public:
         QTadsImage::drawFromPaintEvent(win, pos, mode);
     }
 
+    void set_display_site(CHtmlSysImageDisplaySite* site) override
+    {
+        QTadsImage::setDisplaySite(site);
+    }
+
     auto get_width() const -> unsigned long override
     {
-        return QTadsImage::width();
+        return QTadsImage::imageWidth();
     }
 
     auto get_height() const -> unsigned long override
     {
-        return QTadsImage::height();
+        return QTadsImage::imageHeight();
     }
 
     auto map_palette(CHtmlSysWin*, int) -> int override
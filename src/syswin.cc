@@ -1,10 +1,15 @@
 // This is copyrighted software. More information is at the end of this file.
 #include <QBoxLayout>
+#include <QElapsedTimer>
 #include <QPainter>
 #include <QResizeEvent>
 #include <QScrollBar>
 #include <qdrawutil.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
+#include "benchtimer.h"
 #include "dispwidget.h"
 #include "qtadstimer.h"
 #include "settings.h"
@@ -84,8 +89,78 @@ CHtmlSysWinQt::~CHtmlSysWinQt()
     }
 }
 
+auto CHtmlSysWinQt::fPainterFor(std::optional<QPainter>& fallback) -> QPainter&
+{
+    if (fPainter != nullptr) {
+        return *fPainter;
+    }
+    fallback.emplace(dispWidget);
+    return *fallback;
+}
+
+auto CHtmlSysWinQt::fStaticTextFor(
+    const CHtmlDisp* disp, CHtmlSysFont* font, const textchar_t* str, size_t len)
+    -> const QStaticText&
+{
+    // Don't let the cache grow without bounds in windows that never get
+    // cleared.
+    static constexpr int MAX_STATIC_TEXT_RUNS = 8192;
+
+    const auto key = qMakePair(disp, str);
+    auto it = fStaticTextRuns.find(key);
+    if (it != fStaticTextRuns.end() and it->font == font
+        and static_cast<size_t>(it->text.size()) == len
+        and std::memcmp(it->text.constData(), str, len) == 0)
+    {
+        it->lastUse = ++fStaticTextClock;
+        return it->staticText;
+    }
+
+    if (it == fStaticTextRuns.end() and fStaticTextRuns.size() >= MAX_STATIC_TEXT_RUNS) {
+        fEvictStaticText();
+    }
+    StaticTextRun run{
+        font, QByteArray(str, len), ++fStaticTextClock,
+        QStaticText(QString::fromUtf8(str, len))};
+    run.staticText.setTextFormat(Qt::PlainText);
+    run.staticText.prepare(QTransform(), *static_cast<CHtmlSysFontQt*>(font));
+    return fStaticTextRuns.insert(key, std::move(run))->staticText;
+}
+
+void CHtmlSysWinQt::fEvictStaticText()
+{
+    std::vector<quint64> uses;
+    uses.reserve(fStaticTextRuns.size());
+    for (auto it = fStaticTextRuns.cbegin(); it != fStaticTextRuns.cend(); ++it) {
+        uses.push_back(it->lastUse);
+    }
+    const auto middle = uses.begin() + uses.size() / 2;
+    std::nth_element(uses.begin(), middle, uses.end());
+    const quint64 cutoff = *middle;
+    for (auto it = fStaticTextRuns.begin(); it != fStaticTextRuns.end();) {
+        if (it->lastUse < cutoff) {
+            it = fStaticTextRuns.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void CHtmlSysWinQt::fSetupPainterForFont(QPainter& painter, bool hilite, CHtmlSysFont* font)
 {
+    if (&painter == fPainter) {
+        // This is the shared painter.  If it's already set up for this font,
+        // there's nothing to do.  Otherwise, undo whatever the previous font
+        // changed.
+        if (font == fPainterFont and hilite == fPainterHilite) {
+            return;
+        }
+        fPainterFont = font;
+        fPainterHilite = hilite;
+        painter.setBackgroundMode(Qt::TransparentMode);
+        painter.setPen(dispWidget->palette().color(dispWidget->foregroundRole()));
+    }
+
     const CHtmlSysFontQt& fontCast = *static_cast<CHtmlSysFontQt*>(font);
     painter.setFont(fontCast);
 
@@ -354,11 +429,12 @@ void CHtmlSysWinQt::calcChildBannerSizes(QRect& parentSize)
         dispWidget->resize(
             dispWidget->width(), dispWidget->height() + (newSize.height() - oldSize.height()));
 
-        // Since we changed size, we will need a reformat.
-        // if (this != qFrame->gameWindow())
-        // qDebug() << newSize.width();
-        // if (newSize.width() != oldSize.width())
-        qFrame->scheduleReformat();
+        // Lines only wrap differently if our width changed; moving us or
+        // changing our height doesn't affect the layout.
+        if (newSize.width() != oldSize.width()) {
+            markForReformat();
+            qFrame->scheduleReformat();
+        }
     }
 
     // qFrame->gameWindow()->verticalScrollBar()->triggerAction(QAbstractSlider::SliderToMaximum);
@@ -367,6 +443,8 @@ void CHtmlSysWinQt::calcChildBannerSizes(QRect& parentSize)
 
 void CHtmlSysWinQt::doReformat(int showStatus, int freezeDisplay, int resetSounds)
 {
+    fNeedsReformat = false;
+
     // Forget any tracking links.
     dispWidget->notifyClearContents();
 
@@ -531,7 +609,8 @@ auto CHtmlSysWinQt::measure_text(CHtmlSysFont* font, const textchar_t* str, size
 {
     // qDebug() << Q_FUNC_INFO;
 
-    const QFontMetrics& tmpMetr = QFontMetrics(*static_cast<CHtmlSysFontQt*>(font));
+    const auto* qtFont = static_cast<CHtmlSysFontQt*>(font);
+    const QFontMetrics& tmpMetr = qtFont->metrics();
     if (ascent != nullptr) {
         *ascent = tmpMetr.ascent();
     }
@@ -539,81 +618,97 @@ auto CHtmlSysWinQt::measure_text(CHtmlSysFont* font, const textchar_t* str, size
     // subsequent text should be drawn.  This is really what our caller needs
     // to know, otherwise letters will start jumping left and right when
     // selecting text or moving the text cursor.
-    return {tmpMetr.width(QString::fromUtf8(str, len)), tmpMetr.height()};
+    return {qtFont->textWidth(str, len), tmpMetr.height()};
 }
 
 auto CHtmlSysWinQt::get_max_chars_in_width(
     CHtmlSysFont* font, const textchar_t* str, size_t len, long wid) -> size_t
 {
-    // We bisect the results of measure_text() for the maximum amount of
-    // characters that fit.
-    int begin = 1;
-    int end = len;
-    int mid = (begin + end) / 2;
-
-    while (end >= begin) {
-        mid = (begin + end) / 2;
-        // We might have landed inside a UTF-8 continuation byte. In that case,
-        // adjust mid until we have a complete UTF character.
-        while ((str[mid] & 0xC0) == 0x80 and mid > begin and mid < end) {
-            ++mid;
-        }
-        long bestFit = measure_text(font, str, mid, nullptr).x;
-        if (bestFit > wid) {
-            end = mid - 1;
-        } else if (bestFit < wid) {
-            begin = mid + 1;
-        } else {
-            return mid;
-        }
-    }
+    // Walk the run once, adding up advances until we hit the limit.
+    return static_cast<CHtmlSysFontQt*>(font)->charsInWidth(str, len, wid);
+}
 
-    // We didn't find an exact match, which means one less than the result we
-    // got will fit.
-    --mid;
-    // If that got us inside a UTF-8 sequence, skip to the character's first
-    // byte.
-    while (mid > 0 and (str[mid] & 0xC0) == 0x80) {
-        --mid;
+// Skips a stray UTF-8 continuation byte at the start of the text.
+static void skipStrayContinuationByte(const textchar_t*& str, size_t& len)
+{
+    if (len != 0 and (0x80 & *str) != 0x00 and (0xE0 & *str) != 0xC0 and (0xF0 & *str) != 0xE0
+        and (0xF8 & *str) != 0xF0)
+    {
+        // qDebug() << "ERROR";
+        ++str;
+        --len;
     }
-    return mid > 0 ? mid : 0;
 }
 
 void CHtmlSysWinQt::draw_text(
     int hilite, long x, long y, CHtmlSysFont* font, const textchar_t* str, size_t len)
 {
-    if (len == 0) {
-        // Huh?
+    draw_text_item(nullptr, hilite, x, y, font, str, len);
+}
+
+void CHtmlSysWinQt::advise_text_item_layout(
+    const CHtmlDisp* disp, const CHtmlRect* pos, CHtmlSysFont* font, const textchar_t* str,
+    size_t len)
+{
+    // Shape the text now if it's about to be shown: it's in the visible area,
+    // or in the one below it, where new output shows up.  Anything else is
+    // shaped if and when it's drawn.  Text with a background color isn't drawn
+    // from a pre-shaped run.
+    skipStrayContinuationByte(str, len);
+    if (len == 0 or static_cast<CHtmlSysFontQt*>(font)->use_font_bgcolor()) {
         return;
     }
-
-    if ((0x80 & *str) != 0x00 and (0xE0 & *str) != 0xC0 and (0xF0 & *str) != 0xE0
-        and (0xF8 & *str) != 0xF0)
-    {
-        // qDebug() << "ERROR";
-        ++str;
-        --len;
+    const long top = verticalScrollBar()->value();
+    const long height = viewport()->height();
+    if (pos->bottom < top or pos->top > top + 2 * height) {
+        return;
     }
+    fStaticTextFor(disp, font, str, len);
+}
+
+void CHtmlSysWinQt::draw_text_item(
+    const CHtmlDisp* disp, int hilite, long x, long y, CHtmlSysFont* font, const textchar_t* str,
+    size_t len)
+{
+    skipStrayContinuationByte(str, len);
     if (len == 0) {
         return;
     }
 
-    QPainter painter(dispWidget);
+    std::optional<QPainter> localPainter;
+    QPainter& painter = fPainterFor(localPainter);
     fSetupPainterForFont(painter, hilite, font);
-    painter.drawText(x, y + painter.fontMetrics().ascent(), QString::fromUtf8(str, len));
-    if (static_cast<CHtmlSysFontQt*>(font)->needs_fake_bold) {
-        painter.drawText(x + 1, y + painter.fontMetrics().ascent(), QString::fromUtf8(str, len));
+    const auto* qtFont = static_cast<CHtmlSysFontQt*>(font);
+
+    // Text without a background can be drawn from a pre-shaped run.  Static
+    // text doesn't paint an opaque background, so anything highlighted or with
+    // a background color goes through the normal path.
+    if (not hilite and not qtFont->use_font_bgcolor()) {
+        const QStaticText& staticText = fStaticTextFor(disp, font, str, len);
+        painter.drawStaticText(x, y, staticText);
+        if (qtFont->needs_fake_bold) {
+            painter.drawStaticText(x + 1, y, staticText);
+        }
+        return;
+    }
+
+    const int baseline = y + qtFont->metrics().ascent();
+    const QString& text = QString::fromUtf8(str, len);
+    painter.drawText(x, baseline, text);
+    if (qtFont->needs_fake_bold) {
+        painter.drawText(x + 1, baseline, text);
     }
 }
 
 void CHtmlSysWinQt::draw_text_space(int hilite, long x, long y, CHtmlSysFont* font, long wid)
 {
-    QPainter painter(dispWidget);
+    std::optional<QPainter> localPainter;
+    QPainter& painter = fPainterFor(localPainter);
     fSetupPainterForFont(painter, hilite, font);
 
     // Construct a string of spaces that's at least 'width' pixels wide.
     QString str(' ');
-    const QFontMetrics& metr = painter.fontMetrics();
+    const QFontMetrics& metr = static_cast<CHtmlSysFontQt*>(font)->metrics();
     while (metr.width(str) < wid) {
         str.append(' ');
     }
@@ -649,7 +744,9 @@ void CHtmlSysWinQt::draw_hrule(const CHtmlRect* pos, int shade)
     // qDebug() << Q_FUNC_INFO;
     Q_ASSERT(pos != nullptr);
 
-    QPainter painter(dispWidget);
+    std::optional<QPainter> localPainter;
+    QPainter& painter = fPainterFor(localPainter);
+    resetPainterState();
     if (shade) {
         if (pos->bottom - pos->top > 2) {
             qDrawShadePanel(
@@ -670,7 +767,9 @@ void CHtmlSysWinQt::draw_table_border(const CHtmlRect* pos, int width, int cell)
 {
     // qDebug() << Q_FUNC_INFO;
 
-    QPainter pnt(dispWidget);
+    std::optional<QPainter> localPainter;
+    QPainter& pnt = fPainterFor(localPainter);
+    resetPainterState();
     QPalette pal;
     // Use Midlight for Light to closer match Windows HTML TADS appearance.
     pal.setColor(QPalette::Light, QApplication::palette().color(QPalette::Midlight));
@@ -683,7 +782,9 @@ void CHtmlSysWinQt::draw_table_bkg(const CHtmlRect* pos, HTML_color_t bgcolor)
 {
     // qDebug() << Q_FUNC_INFO;
 
-    QPainter painter(dispWidget);
+    std::optional<QPainter> localPainter;
+    QPainter& painter = fPainterFor(localPainter);
+    resetPainterState();
     int red = HTML_color_red(bgcolor);
     int green = HTML_color_green(bgcolor);
     int blue = HTML_color_blue(bgcolor);
@@ -697,6 +798,26 @@ void CHtmlSysWinQt::draw_dbgsrc_icon(const CHtmlRect*, unsigned int)
     qDebug() << Q_FUNC_INFO;
 }
 
+void CHtmlSysWinQt::fResizeDisplayWidget(const bool growOnly)
+{
+    if (fBannerStyleGrid) {
+        dispWidget->resize(viewport()->size());
+        return;
+    }
+
+    long newWidth;
+    if (formatter_->get_outer_max_line_width() > viewport()->width()) {
+        newWidth = formatter_->get_outer_max_line_width();
+    } else {
+        newWidth = viewport()->width();
+    }
+    long newHeight = formatter_->get_max_y_pos();
+    if (growOnly and newHeight < dispWidget->height()) {
+        newHeight = dispWidget->height();
+    }
+    dispWidget->resize(newWidth, newHeight);
+}
+
 auto CHtmlSysWinQt::do_formatting(int /*show_status*/, int update_win, int freeze_display) -> int
 {
     // qDebug() << Q_FUNC_INFO;
@@ -706,6 +827,8 @@ auto CHtmlSysWinQt::do_formatting(int /*show_status*/, int update_win, int freez
         return false;
     }
 
+    BENCH_SCOPE(Format);
+
     // If desired, freeze display updating while we're working.
     if (freeze_display) {
         formatter_->freeze_display(true);
@@ -718,65 +841,58 @@ auto CHtmlSysWinQt::do_formatting(int /*show_status*/, int update_win, int freez
     }
 
     // Get the window area in document coordinates, so we'll know when we've
-    // formatted past the bottom of the current display area.  Note that we'll
-    // ignore the presence or absence of a horizontal scrollbar, since it could
-    // come or go while we're formatting; by assuming that it won't be there,
-    // we'll be maximally conservative about redrawing the whole area.
-    // unsigned long winBottom = qMax(static_cast<unsigned long>(height()),
-    // formatter_->get_max_y_pos());
+    // formatted past the bottom of the current display area.
+    const long winBottom = verticalScrollBar()->value() + viewport()->height();
 
     // We don't have enough formatting done yet to draw the window.
     bool drawn = false;
 
-    // Reformat everything, drawing as soon as possible, if desired.
-    /*
-    if (update_win) {
-        while (formatter_->more_to_do() and not drawn) {
-            // Format another line.
-            formatter_->do_formatting();
-
-            // If we have enough content to do so, redraw the window; we're not
-            // really done with the formatting yet, but at least we'll update
-            // the window as soon as we can, so the user isn't staring at a
-            // blank window longer than necessary.
-            if (formatter_->get_max_y_pos() >= winBottom) {
-                // If the formatter's updating is frozen, invalidate the window;
-                // the formatter won't have been invalidating it as it goes.
-                if (freeze_display) {
-                    viewport()->update();
-                }
-
-                // Let the event loop redraw the window.
-                qFrame->advanceEventLoop();
-
-                // We've now drawn it.
-                drawn = true;
+    // When reformatting (the window is to be updated, or its display is
+    // frozen), long documents can take a while. So we format in slices,
+    // letting the event loop run in between so that the window stays alive
+    // and the scrollbar follows along, and draw the window as soon as the
+    // visible area has been formatted. User input is held back until we're
+    // done, since it would act on a half-formatted document.
+    const bool progressive = update_win or freeze_display;
+    static constexpr qint64 FORMAT_SLICE_TIME = 16;
+    QElapsedTimer sliceTimer;
+    sliceTimer.start();
+    ++fDontReformat;
+    while (formatter_->more_to_do()) {
+        formatter_->do_formatting();
+        if (not progressive or sliceTimer.elapsed() < FORMAT_SLICE_TIME) {
+            continue;
+        }
+
+        // Grow the scrollable area to what we've formatted so far. Don't
+        // shrink it yet, so that the scroll position is kept.
+        fResizeDisplayWidget(true);
+
+        // If we have enough content to do so, redraw the window; we're not
+        // really done with the formatting yet, but at least we'll update the
+        // window as soon as we can, so the user isn't staring at a blank
+        // window longer than necessary.
+        if (not drawn and formatter_->get_max_y_pos() >= winBottom) {
+            // If the formatter's updating is frozen, invalidate the window;
+            // the formatter won't have been invalidating it as it goes.
+            if (freeze_display) {
+                dispWidget->invalidateTiles();
+                dispWidget->update();
             }
+            drawn = true;
         }
-    }
-    */
 
-    // After drawing, keep going until we've formatted everything.
-    while (formatter_->more_to_do()) {
-        formatter_->do_formatting();
+        qFrame->advanceEventLoop(QEventLoop::ExcludeUserInputEvents, FORMAT_SLICE_TIME);
+        sliceTimer.restart();
     }
+    --fDontReformat;
 
     // Unfreeze the display if we froze it.
     if (freeze_display) {
         formatter_->freeze_display(false);
     }
 
-    if (fBannerStyleGrid) {
-        dispWidget->resize(viewport()->size());
-    } else {
-        long newWidth;
-        if (formatter_->get_outer_max_line_width() > viewport()->width()) {
-            newWidth = formatter_->get_outer_max_line_width();
-        } else {
-            newWidth = viewport()->width();
-        }
-        dispWidget->resize(newWidth, formatter_->get_max_y_pos());
-    }
+    fResizeDisplayWidget(false);
 
     // If we didn't do any drawing, and we updated the window coming in,
     // invalidate the window - the initial redraw will have validated
@@ -784,12 +900,18 @@ auto CHtmlSysWinQt::do_formatting(int /*show_status*/, int update_win, int freez
     // around to drawing it.  Do the same thing if we froze the display and we
     // didn't do any updating.
     if ((update_win and not drawn) or freeze_display) {
+        dispWidget->invalidateTiles();
         dispWidget->update();
     }
 
     // Make sure we don't lose any link we were previously tracking.
     dispWidget->updateLinkTracking(QPoint());
 
+    // A resize while we were formatting will have asked for a reformat that
+    // had to wait for us. Run it from the event loop, once our caller is done
+    // with the formatter too.
+    qFrame->scheduleDeferredReformat();
+
     // Return an indication of whether we did any updating.
     return drawn;
 }
@@ -907,13 +1029,28 @@ void CHtmlSysWinQt::inval_doc_coords(const CHtmlRect* area)
     long height = area->bottom == HTMLSYSWIN_MAX_BOTTOM ? dispWidget->height() - area->top
                                                         : area->bottom - area->top;
 
-    dispWidget->update(QRect(area->left, area->top, width, height));
+    const QRect rect(area->left, area->top, width, height);
+    dispWidget->invalidateTiles(rect);
+    dispWidget->update(rect);
 }
 
 void CHtmlSysWinQt::advise_clearing_disp_list()
 {
     // qDebug() << Q_FUNC_INFO;
     dispWidget->notifyClearContents();
+    dispWidget->invalidateTiles();
+
+    // The pre-shaped runs of the items that are going away stay cached.  The
+    // formatter tends to put new items with the same text at the same
+    // addresses when it reformats, and the rest are evicted once unused.
+}
+
+void CHtmlSysWinQt::advise_replacing_disp_list()
+{
+    // The new display list looks the same until the formatter invalidates
+    // what changed, so our rendered tiles are still good.  We only need to
+    // forget the items we're tracking.
+    dispWidget->notifyClearContents();
 }
 
 void CHtmlSysWinQt::scroll_to_doc_coords(const CHtmlRect*)
@@ -1149,6 +1286,8 @@ void CHtmlSysWinQt::set_html_bg_image(CHtmlResCacheObject* image)
         castImg = reinterpret_cast<QTadsImage*>(image->get_image());
     }
 
+    // The brush needs the actual pixels.
+    castImg->waitForDecode();
     QPalette p(palette());
     p.setBrush(QPalette::Base, *castImg);
     setPalette(p);
@@ -2,7 +2,12 @@
 #pragma once
 #include <QApplication>
 #include <QDesktopWidget>
+#include <QHash>
+#include <QPair>
+#include <QPainter>
 #include <QScrollArea>
+#include <QStaticText>
+#include <optional>
 
 #include "config.h"
 #include "globals.h"
@@ -42,6 +47,10 @@ private:
     // Guard against re-entrancy for do_formatting().
     int fDontReformat;
 
+    // Resize the display widget to the formatted size of the document.  With
+    // 'growOnly', the widget doesn't get any shorter than it is.
+    void fResizeDisplayWidget(bool growOnly);
+
     // Are we currently in page-pause mode?
     bool fInPagePauseMode;
 
@@ -62,6 +71,45 @@ private:
     HTML_color_t fALinkColor = 0;
     HTML_color_t fHLinkColor = 0;
 
+    // The painter of the paint pass that is currently in progress, if any.
+    // All draw callbacks share it, so that we don't need to create and set up
+    // a new painter for every text run.
+    QPainter* fPainter = nullptr;
+
+    // The font and highlight state last applied to fPainter.  We only touch
+    // the painter's state when these change.
+    CHtmlSysFont* fPainterFont = nullptr;
+    bool fPainterHilite = false;
+
+    // Pre-shaped text runs, keyed by the display item drawing them and the
+    // address of the text.  A grid item draws several runs, and an item's
+    // address can be reused after it's deleted, so the font and text are
+    // checked on lookup.  Runs are shaped when the formatter lays out text
+    // near the visible area, or else on first paint.  When there are too
+    // many, the ones used least recently are dropped.
+    struct StaticTextRun
+    {
+        const CHtmlSysFont* font;
+        QByteArray text;
+        quint64 lastUse;
+        QStaticText staticText;
+    };
+    QHash<QPair<const CHtmlDisp*, const textchar_t*>, StaticTextRun> fStaticTextRuns;
+    quint64 fStaticTextClock = 0;
+
+    // Returns the pre-shaped run for the given text, creating it if needed.
+    auto fStaticTextFor(
+        const CHtmlDisp* disp, CHtmlSysFont* font, const textchar_t* str, size_t len)
+        -> const QStaticText&;
+
+    // Drops the least recently used half of the pre-shaped runs.
+    void fEvictStaticText();
+
+    // Returns the painter draw callbacks should use.  During a paint pass,
+    // that's the shared painter.  Otherwise, a painter on our display widget
+    // is created in 'fallback'.
+    auto fPainterFor(std::optional<QPainter>& fallback) -> QPainter&;
+
     void fSetupPainterForFont(QPainter& painter, bool hilite, CHtmlSysFont* font);
 
 protected:
@@ -112,9 +160,58 @@ public:
     // area after deducting the space carved out for children.
     void calcChildBannerSizes(QRect& parentSize);
 
+    // Called by our display widget around the formatter's draw() call in its
+    // paint event.  The given painter is used by all draw callbacks until
+    // endPaint() is called.
+    void beginPaint(QPainter& painter)
+    {
+        fPainter = &painter;
+        fPainterFont = nullptr;
+    }
+
+    void endPaint()
+    {
+        fPainter = nullptr;
+        fPainterFont = nullptr;
+    }
+
+    // The painter of the paint pass in progress, or null if we're not
+    // painting.
+    auto activePainter() const -> QPainter*
+    {
+        return fPainter;
+    }
+
+    // Called by anything other than text drawing that uses the shared painter,
+    // since it might change the pen, brush or background.  The next text run
+    // sets the painter up from scratch.
+    void resetPainterState()
+    {
+        fPainterFont = nullptr;
+    }
+
+    // Note that the window's layout is out of date.  The next call to
+    // CHtmlSysFrameQt::reformatBanners() will reformat it; windows that
+    // weren't marked keep their current layout.
+    void markForReformat()
+    {
+        fNeedsReformat = true;
+    }
+
+    auto pendingReformat() const -> bool
+    {
+        return fNeedsReformat;
+    }
+
     // Do a complete reformat.
     void doReformat(int showStatus, int freezeDisplay, int resetSounds);
 
+    // Are we in the middle of do_formatting()?
+    auto isFormatting() const -> bool
+    {
+        return fDontReformat != 0;
+    }
+
     void addBanner(
         CHtmlSysWinQt* banner, HTML_BannerWin_Type_t type, int where, CHtmlSysWinQt* other,
         HTML_BannerWin_Pos_t pos, unsigned long style);
@@ -171,6 +268,14 @@ public:
     void draw_text(
         int hilite, long x, long y, CHtmlSysFont* font, const textchar_t* str, size_t len) override;
 
+    void draw_text_item(
+        const CHtmlDisp* disp, int hilite, long x, long y, CHtmlSysFont* font,
+        const textchar_t* str, size_t len) override;
+
+    void advise_text_item_layout(
+        const CHtmlDisp* disp, const CHtmlRect* pos, CHtmlSysFont* font, const textchar_t* str,
+        size_t len) override;
+
     void draw_text_space(int hilite, long x, long y, CHtmlSysFont* font, long wid) override;
 
     void draw_bullet(
@@ -237,6 +342,8 @@ public:
 
     void advise_clearing_disp_list() override;
 
+    void advise_replacing_disp_list() override;
+
     void scroll_to_doc_coords(const CHtmlRect* pos) override;
 
     void get_scroll_doc_coords(CHtmlRect* pos) override;
@@ -284,6 +391,10 @@ public:
     void set_banner_info(HTML_BannerWin_Pos_t pos, unsigned long style) override;
 
     void get_banner_info(HTML_BannerWin_Pos_t* pos, unsigned long* style) override;
+
+private:
+    // Do we need to be reformatted?
+    bool fNeedsReformat = false;
 };
 
 /*
@@ -10,7 +10,9 @@
 #include <QTimer>
 #include <QUrl>
 
+#include "benchtimer.h"
 #include "dispwidgetinput.h"
+#include "idlegc.h"
 #include "settings.h"
 #include "syswininput.h"
 
@@ -405,6 +407,9 @@ void CHtmlSysWinInputQt::getInput(
     // qDebug() << Q_FUNC_INFO;
     Q_ASSERT(buf != nullptr);
 
+    // Show any output whose formatting is still pending.
+    qFrame->flushPendingOutput();
+
     auto* formatter = static_cast<CHtmlFormatterInput*>(formatter_);
 
     bool resuming = fTag != nullptr;
@@ -426,8 +431,11 @@ void CHtmlSysWinInputQt::getInput(
     } else {
         // Since we're not resuming, make sure that we've formatted all
         // available input and tell the formatter to begin a new input.
-        while (formatter->more_to_do()) {
-            formatter->do_formatting();
+        {
+            BENCH_SCOPE(Format);
+            while (formatter->more_to_do()) {
+                formatter->do_formatting();
+            }
         }
         fTadsBuffer.setbuf(
             fInputBuffer.data(),
@@ -454,6 +462,10 @@ void CHtmlSysWinInputQt::getInput(
     // everything up to here.
     lastInputHeight = formatter_->get_max_y_pos();
 
+    // Collect garbage while we wait.
+    IdleGarbageCollector idleGc;
+    emit inputRequested();
+
     if (useTimeout) {
         QEventLoop idleLoop;
         QTimer timer;
@@ -526,6 +538,7 @@ void CHtmlSysWinInputQt::cancelInput(bool reset)
     // operation takes a while to complete.
     if (wasAtBottom) {
         qFrame->flush_txtbuf(true, true);
+        qFrame->flushPendingOutput();
         verticalScrollBar()->triggerAction(QAbstractSlider::SliderToMaximum);
         qFrame->advanceEventLoop();
     }
@@ -556,11 +569,17 @@ auto CHtmlSysWinInputQt::getKeypress(unsigned long timeout, bool useTimeout, boo
         return extKey;
     }
 
+    // Show any output whose formatting is still pending.
+    qFrame->flushPendingOutput();
+
     // Prepare the formatter for input and format all remaining lines.
     CHtmlFormatterInput* formatter = static_cast<CHtmlFormatterInput*>(formatter_);
     formatter->prepare_for_input();
-    while (formatter->more_to_do()) {
-        formatter->do_formatting();
+    {
+        BENCH_SCOPE(Format);
+        while (formatter->more_to_do()) {
+            formatter->do_formatting();
+        }
     }
 
     // scrollDown();
@@ -576,6 +595,8 @@ auto CHtmlSysWinInputQt::getKeypress(unsigned long timeout, bool useTimeout, boo
     // Reset the MORE prompt position to this point, since the user has seen
     // everything up to here.
     lastInputHeight = formatter_->get_max_y_pos();
+    IdleGarbageCollector idleGc;
+    emit keypressRequested();
     if (useTimeout) {
         QEventLoop idleLoop;
         QTimer timer;
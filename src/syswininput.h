@@ -90,6 +90,11 @@ signals:
     // Emitted when an input operation has finished successfully.
     void inputReady();
 
+    // Emitted when getInput() or getKeypress() is about to wait for the
+    // player, after all pending output has been formatted.
+    void inputRequested();
+    void keypressRequested();
+
 public:
     CHtmlSysWinInputQt(class CHtmlFormatter* formatter, QWidget* parent);
 